@@ -1,9 +1,30 @@
 #ifndef AnalogMuxScanner_h
 #define AnalogMuxScanner_h
 
+#define ADC_CONVERSION_US 104 // 13 ADC clocks at 16 MHz / 128
+#define POT_FAST_THRESHOLD 24 // counts the filtered value is behind => the pot is being turned
+
 
 typedef void (*Change)(int channel, int pot, uint16_t value);
 
+class AnalogMuxScanner;
+AnalogMuxScanner* activeAnalogMuxScanner = nullptr; // the one the ADC interrupt feeds
+
+/*
+* The ADC converts a whole sweep - every mux address on every pin - on its
+* own: each conversion complete interrupt stores the sample, selects the
+* next pin (and the next mux address after the last pin) and starts the
+* next conversion. scan() only filters the finished sweep and starts the
+* next one, so a sweep of all pots takes 24 conversions (~2.5 ms) and costs
+* the loop no analogRead at all. Chaining from the interrupt rather than
+* auto-triggering, because a free running ADC picks up a new channel only
+* one conversion late.
+*
+* Every pot is filtered on its own: a median of the last 3 samples drops
+* spikes, then an exponential average that follows quickly while the pot is
+* turned and slowly (quiet) while it rests. Masked pots - dead or noisy ones -
+* are never reported.
+*/
 class AnalogMuxScanner {
 private:
   uint8_t _s0, _s1, _s2;
@@ -12,25 +33,66 @@ private:
 
   Change  _onChange = nullptr;
 
-  uint8_t  _mux = 0;
   uint32_t _lastScanMs = 0;
   uint16_t _scanIntervalMs = 5;
   uint16_t _hysteresis     = 3;
-  uint8_t  _samplesPerRead = 1;
-
+  uint32_t _masked = 0; // bit pr pot, channel * 3 + pot
+
+  // written by the ADC interrupt while a sweep runs
+  volatile uint8_t _mux = 0;
+  volatile uint8_t _pin = 0;
+  volatile bool    _sweeping = false;
+  bool _hasSweep = false;
+  volatile uint16_t* _samples;
+#ifndef __AVR__
+  uint32_t _sweepStartUs = 0;
+  uint8_t  _converted = 0;
+#endif
+
+  uint16_t* _history; // last 3 samples pr pot
+  uint16_t* _average; // x16
   uint16_t* _stable;
   bool*     _hasStable;
 
-  uint16_t readInvertedAnalog(uint8_t pin) {
-    if (_samplesPerRead <= 1) {
-      return (uint16_t)(1023 - analogRead(pin));
-    }
-    uint32_t sum = 0;
-    for (uint8_t i = 0; i < _samplesPerRead; ++i) sum += analogRead(pin);
-    uint16_t avg = (uint16_t)(sum / _samplesPerRead);
-    return (uint16_t)(1023 - avg);
+  void selectMux(uint8_t mux) {
+    digitalWrite(_s0, (mux & 0x01));
+    digitalWrite(_s1, (mux & 0x02) >> 1);
+    digitalWrite(_s2, (mux & 0x04) >> 2);
+  }
+
+  void startConversion() {
+#ifdef __AVR__
+    uint8_t channel = _a[_pin] - A0;
+    ADMUX = (1 << REFS0) | (channel & 0x07); // AVcc reference
+    if (channel & 0x08) ADCSRB |= (1 << MUX5);
+    else ADCSRB &= ~(1 << MUX5);
+    ADCSRA |= (1 << ADSC);
+#endif
+  }
+
+  static uint16_t median3(uint16_t a, uint16_t b, uint16_t c) {
+    if (a > b) { uint16_t t = a; a = b; b = t; }
+    if (b > c) b = c;
+    return (a > b) ? a : b;
   }
 
+  void filter(uint16_t idx, uint16_t raw) {
+    uint16_t* history = &_history[idx * 3];
+    if (!_hasStable[idx]) {
+      history[0] = history[1] = history[2] = raw;
+      _average[idx] = raw << 4;
+    } else {
+      history[0] = history[1];
+      history[1] = history[2];
+      history[2] = raw;
+    }
+
+    uint16_t value = median3(history[0], history[1], history[2]);
+    int diff = (int)value - (int)(_average[idx] >> 4);
+    // a turned pot follows within a few sweeps, a resting one averages over 8
+    uint8_t shift = (diff > POT_FAST_THRESHOLD || diff < -POT_FAST_THRESHOLD) ? 1 : 3;
+    _average[idx] = (uint16_t)((int32_t)_average[idx] + (((int32_t)value << 4) - (int32_t)_average[idx]) / (1 << shift));
+  }
 
 public:
 
@@ -42,16 +104,23 @@ public:
     _a{a0, a1, a2},
     _channels(channels)
   {
-    // allocate per-channel/pot stable storage
+    // allocate per-channel/pot storage
+    _samples = new uint16_t[8 * 3];
+    _history = new uint16_t[_channels * 3 * 3];
+    _average = new uint16_t[_channels * 3];
     _stable = new uint16_t[_channels * 3];
     _hasStable = new bool[_channels * 3];
     for (uint16_t i = 0; i < _channels * 3; ++i) {
+      _average[i] = 0;
       _stable[i] = 0;
       _hasStable[i] = false;
     }
   }
 
   ~AnalogMuxScanner() {
+    delete[] _samples;
+    delete[] _history;
+    delete[] _average;
     delete[] _stable;
     delete[] _hasStable;
   }
@@ -60,62 +129,111 @@ public:
     pinMode(_s0, OUTPUT);
     pinMode(_s1, OUTPUT);
     pinMode(_s2, OUTPUT);
+    selectMux(0);
+    activeAnalogMuxScanner = this;
+#ifdef __AVR__
+    ADCSRA = (1 << ADEN) | (1 << ADIE) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0); // prescaler 128
+#endif
   }
 
   void setScanInterval(uint16_t ms) { _scanIntervalMs = ms; }
   void setHysteresis(uint16_t counts) { _hysteresis = counts; }    // e.g., 2–5 counts
-  void setSamplesPerRead(uint8_t n) { _samplesPerRead = (n == 0) ? 1 : n; }
+
+  // masked pots are still converted but never reported
+  void maskPot(int channel, int pot, bool masked = true) {
+    uint32_t bit = 1UL << (channel * 3 + pot);
+    if (masked) _masked |= bit;
+    else _masked &= ~bit;
+  }
+
+  bool isMasked(int channel, int pot) {
+    return (_masked >> (channel * 3 + pot)) & 1;
+  }
+
+  uint16_t value(int channel, int pot) {
+    return _stable[channel * 3 + pot];
+  }
 
   void onChange(Change onChangeHandler) {
     _onChange = onChangeHandler;
   }
 
+  // ADC interrupt side
+  void onConversion(uint16_t sample) {
+    _samples[_mux * 3 + _pin] = sample;
+    if (++_pin < 3) {
+      startConversion();
+      return;
+    }
+    _pin = 0;
+    _mux = (_mux + 1) & 0x07;
+    selectMux(_mux);
+    if (_mux == 0) {
+      _sweeping = false;
+      return;
+    }
+    startConversion();
+  }
+
   // Call regularly (e.g., in loop) when you want scanning active
   void scan(unsigned long now) {
+#ifndef __AVR__
+    // no ADC interrupt on the host - play the conversions that would have completed by now
+    while (_sweeping && (micros() - _sweepStartUs) / ADC_CONVERSION_US > _converted) {
+      _converted++;
+      onConversion(hostAnalogValue(_a[_pin]));
+    }
+#endif
+    if (_sweeping) return;
     if (now - _lastScanMs < _scanIntervalMs) return;
     _lastScanMs = now;
 
-    // Select mux address
-    digitalWrite(_s0, (_mux & 0x01));
-    digitalWrite(_s1, (_mux & 0x02) >> 1);
-    digitalWrite(_s2, (_mux & 0x04) >> 2);
-
-    // Read inverted values (same as map(..., 1023,0,0,1023), but faster)
-    uint16_t values[3] = {
-      readInvertedAnalog(_a[0]),
-      readInvertedAnalog(_a[1]),
-      readInvertedAnalog(_a[2])
-    };
-
-    // Distribute readings using the derived formula:
-    // off = 2*i; ch = (mux + off)/3 + off; pot = (mux + off)%3
-    for (int i = 0; i < 3; ++i) {
-      int off = 2 * i;                       
-      int ch  = (int)(_mux + off) / 3 + off; 
-      int pot = (int)(_mux + off) % 3;       
-
-      if (ch < 0 || ch >= _channels) continue;
-
-      uint16_t raw = values[i];
-      uint16_t idx = ch * 3 + pot;
-
-      if (!_hasStable[idx]) {
-        _stable[idx] = raw;
-        _hasStable[idx] = true;
-        if (_onChange) _onChange(ch, pot, _stable[idx]); // first report
-      } else {
-        int diff = (int)raw - (int)_stable[idx];
-        if (diff < 0) diff = -diff;
-        if (diff >= _hysteresis) {
-          _stable[idx] = raw;
-          if (_onChange) _onChange(ch, pot, _stable[idx]); // report significant change
+    // the sweep is complete, the interrupt doesn't touch the samples until the next one is started
+    for (uint8_t mux = 0; _hasSweep && mux < 8; ++mux) {
+      // Distribute readings using the derived formula:
+      // off = 2*i; ch = (mux + off)/3 + off; pot = (mux + off)%3
+      for (int i = 0; i < 3; ++i) {
+        int off = 2 * i;
+        int ch  = (int)(mux + off) / 3 + off;
+        int pot = (int)(mux + off) % 3;
+
+        if (ch < 0 || ch >= _channels) continue;
+        if (isMasked(ch, pot)) continue;
+
+        uint16_t idx = ch * 3 + pot;
+        filter(idx, (uint16_t)(1023 - _samples[mux * 3 + i])); // inverted, same as map(..., 1023,0,0,1023)
+        uint16_t filtered = _average[idx] >> 4;
+
+        if (!_hasStable[idx]) {
+          _stable[idx] = filtered;
+          _hasStable[idx] = true;
+          if (_onChange) _onChange(ch, pot, _stable[idx]); // first report
+        } else {
+          int diff = (int)filtered - (int)_stable[idx];
+          if (diff < 0) diff = -diff;
+          if (diff >= _hysteresis) {
+            _stable[idx] = filtered;
+            if (_onChange) _onChange(ch, pot, _stable[idx]); // report significant change
+          }
         }
       }
     }
 
-    // Advance mux (0..7)
-    _mux = (_mux + 1) & 0x07;
+    // next sweep, the mux is back at address 0
+    _sweeping = true;
+    _hasSweep = true;
+#ifndef __AVR__
+    _sweepStartUs = micros();
+    _converted = 0;
+#endif
+    startConversion();
   }
 };
 
-#endif
\ No newline at end of file
+#ifdef __AVR__
+ISR(ADC_vect) {
+  if (activeAnalogMuxScanner) activeAnalogMuxScanner->onConversion(ADC);
+}
+#endif
+
+#endif
@@ -13,14 +13,12 @@ private:
   uint8_t _channelNumber;
   DebounceButton165 *_button;
 
-  uint16_t _pageCountRaw = 0;
-  uint16_t _repeatsRaw = 0;
-  uint16_t _chainToRaw = 0;
   uint8_t _pageCount = 0;
   uint8_t _repeats = 0;
   int8_t _chainTo = -1;
   uint8_t _remainingRepeats = 0;
   bool _started = false;
+  bool _completed = false; // completion events already fired for this play
 
   bool _hasPulse = false;
   uint8_t _currentStep = 0;
@@ -66,12 +64,26 @@ public:
   }
 
   void Start() {
+    // a re-started part always begins from step 0 - Stop() leaves the step where the downbeat cut it
+    _currentStep = 0;
+    _currentPage = 0;
+    _completed = false;
     _remainingRepeats = (_repeats > 0) ? _repeats-1 : 0;
     _started = true;
     if(_onPartStarted)
       _onPartStarted(_channelNumber);
   }
 
+  // start as if the part had already played the given number of steps - call on a downbeat (steps a multiple of 4)
+  void StartAt(uint16_t steps) {
+    Start();
+    uint16_t length = _lastStep + 1;
+    uint16_t played = steps / length;
+    _currentStep = steps % length;
+    _currentPage = _currentStep / 16;
+    _remainingRepeats = (_remainingRepeats > played) ? _remainingRepeats - played : 0;
+  }
+
   void Stop() {
     _started = false;
     for(int i=0; i<4; i++) {
@@ -125,12 +137,14 @@ public:
 
     }
 
-    if (_currentStep == _lastStep && _remainingRepeats == 0 && ((pulses+2) % 6) == 0) {
+    // fire once pr play - short parts reach the last step again while waiting for the downbeat
+    if (!_completed && _currentStep == _lastStep && _remainingRepeats == 0 && ((pulses+2) % 6) == 0) {
       _onBeforePartCompleted(_channelNumber, _chainTo);
       beforeCompleted = pulses;
     }    
 
-    if (_currentStep == _lastStep && _remainingRepeats == 0 && ((pulses+1) % 6) == 0) {
+    if (!_completed && _currentStep == _lastStep && _remainingRepeats == 0 && ((pulses+1) % 6) == 0) {
+      _completed = true;
       _onPartCompleted(_channelNumber, _chainTo);
       completed = pulses;
     }    
@@ -177,6 +191,10 @@ public:
     return _chainTo;
   }
 
+  uint8_t LastStep() {
+    return _lastStep;
+  }
+
   void SetPageCount(uint8_t pageCount) {
     _pageCount = pageCount;
     _lastStep = pageCount * 16 - 1;
@@ -187,29 +205,12 @@ public:
     }
   }
 
-  void SetPageCountRaw(uint16_t raw) {
-    _pageCountRaw = raw;
-    SetPageCount(map(raw, 0, 1000, 0, 4));
-  }
-
   void SetRepeats(uint8_t repeats) {
     _repeats = repeats;
-    _repeatsRaw = map(_repeats, 0, 32, 0, 1023);
-  }
-
-  void SetRepeatsRaw(uint16_t raw) {
-    _repeatsRaw = raw;
-    SetRepeats(map(raw, 0, 1023, 0, 32));
   }
 
   void SetChainTo(int8_t chainTo) {
     _chainTo = chainTo;
-    _chainToRaw = map(_chainTo, -1, 15, 0, 1023);
-  }
-
-  void SetChainToRaw(uint16_t raw) {
-    _chainToRaw = raw;
-    SetChainTo(map(raw, 0, 1023, -1, 15));
   }
 
   void SetLastStep(uint8_t value) {
@@ -220,16 +221,19 @@ public:
     else if(_lastStep < 32) pageCount = 2;
     else if(_lastStep < 48) pageCount = 3;
     SetPageCount(pageCount);
+    _lastStep = value; // SetPageCount rounds up to the end of the page
   }
 
   void Print() {
-    char s[200];
-    sprintf(s, "part: %d  currentpage: %d  pages: %d  currentstep: %d  laststep: %d  repeats: %d  remaining: %d  chain: %d  is-playing: ", _channelNumber, _currentPage, _pageCount, _currentStep, _lastStep, _repeats, _remainingRepeats, _chainTo);
+    char s[80];
+    sprintf_P(s, PSTR("part: %d  currentpage: %d  pages: %d  currentstep: %d  laststep: %d"), _channelNumber, _currentPage, _pageCount, _currentStep, _lastStep);
+    Serial.print(s);
+    sprintf_P(s, PSTR("  repeats: %d  remaining: %d  chain: %d  is-playing: "), _repeats, _remainingRepeats, _chainTo);
     Serial.print(s);
     if(_started)
-      Serial.print("1");
+      Serial.print(F("1"));
     else
-      Serial.print("0");
+      Serial.print(F("0"));
     Serial.println();
   }
 };
@@ -0,0 +1,81 @@
+#ifndef ClockPulseQueue_h
+#define ClockPulseQueue_h
+
+#include <Arduino.h>
+
+#define CLOCK_QUEUE_SIZE 16 // power of two, ~16 pulses = 2/3 of a beat of slack
+
+/*
+* Single producer (clock ISR) / single consumer (loop) ring of pulse
+* timestamps. The ISR only writes _head and the loop only writes _tail, and
+* both are single bytes, so no locking is needed on the AVR.
+*/
+class ClockPulseQueue {
+  private:
+    volatile unsigned long _timestamps[CLOCK_QUEUE_SIZE];
+    volatile uint8_t _head = 0;
+    volatile uint8_t _tail = 0;
+    volatile uint16_t _dropped = 0;
+    unsigned long _received = 0;
+    uint8_t _maxDepth = 0;
+    unsigned long _maxLatencyUs = 0;
+
+  public:
+    // ISR side
+    void push(unsigned long timestamp) {
+      uint8_t next = (_head + 1) & (CLOCK_QUEUE_SIZE - 1);
+      if (next == _tail) {
+        _dropped++;
+        return;
+      }
+      _timestamps[_head] = timestamp;
+      _head = next;
+    }
+
+    // loop side
+    bool pop(unsigned long& timestamp) {
+      uint8_t tail = _tail;
+      uint8_t head = _head;
+      if (tail == head) return false;
+
+      uint8_t depth = (head - tail) & (CLOCK_QUEUE_SIZE - 1);
+      if (depth > _maxDepth) _maxDepth = depth;
+
+      timestamp = _timestamps[tail];
+      _tail = (tail + 1) & (CLOCK_QUEUE_SIZE - 1);
+      _received++;
+
+      unsigned long latency = micros() - timestamp;
+      if (latency > _maxLatencyUs) _maxLatencyUs = latency;
+      return true;
+    }
+
+    void clear() {
+      _tail = _head;
+    }
+
+    uint16_t Dropped() {
+      noInterrupts();
+      uint16_t dropped = _dropped;
+      interrupts();
+      return dropped;
+    }
+
+    void resetStats() {
+      noInterrupts();
+      _dropped = 0;
+      interrupts();
+      _received = 0;
+      _maxDepth = 0;
+      _maxLatencyUs = 0;
+    }
+
+    void printStats() {
+      char s[100];
+      sprintf_P(s, PSTR("clock pulses => received: %lu | dropped: %u | max queued: %d | max latency: %lu us"),
+              _received, Dropped(), _maxDepth, _maxLatencyUs);
+      Serial.println(s);
+    }
+};
+
+#endif
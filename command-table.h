@@ -0,0 +1,112 @@
+#ifndef CommandTable_h
+#define CommandTable_h
+
+#include <Arduino.h>
+#include "command-tokenizer.h"
+
+#define COMMAND_NAME_LENGTH 18 // longest name + 1
+#define COMMAND_MAX_ARGS 2
+
+#define COMMAND_OPTIONAL 0x80 // the ints may be left out, they are 0 then
+
+// what follows the name, the ints are parsed before the handler is called
+enum CommandArgs : uint8_t {
+  COMMAND_NO_ARGS = 0,
+  COMMAND_INT = 1,
+  COMMAND_INT_INT = 2,
+  COMMAND_OPTIONAL_INT = COMMAND_OPTIONAL | 1
+};
+
+typedef void (*CommandHandler)(const int* args);
+
+struct Command {
+  char name[COMMAND_NAME_LENGTH];
+  uint8_t args;
+  CommandHandler handler;
+};
+
+/*
+* Command tables live in flash and are sorted by name, which the compiler
+* checks (static_assert(tableSorted(table), ...)). Entries sharing the
+* characters matched so far are a contiguous range of a sorted table, so the
+* matcher narrows [first, last] while walking the line once - every entry and
+* every character is looked at once at most, no matter how many commands
+* there are.
+*
+* A name ending in a letter or digit must be followed by a space or the end
+* of the text ("stats" doesn't match "statsx"), others may be followed
+* directly by their arguments ("?2"). The longest matching name wins, so
+* "stats" and "stats reset" can both be commands.
+*/
+constexpr int compareNames(const char* a, const char* b) {
+  return (*a != *b || *a == '\0') ? *a - *b : compareNames(a + 1, b + 1);
+}
+
+template<typename T, size_t N>
+constexpr bool tableSorted(const T (&table)[N], size_t i = 1) {
+  return i >= N || (compareNames(table[i - 1].name, table[i].name) < 0 && tableSorted(table, i + 1));
+}
+
+// index of the entry whose name starts the text, -1 => none. length => the characters the name took
+template<typename T, size_t N>
+int8_t matchTable(const T (&table)[N], TextSpan text, uint8_t& length) {
+  int8_t first = 0;
+  int8_t last = N - 1;
+  int8_t match = -1;
+
+  for(uint8_t i = 0; first <= last; i++) {
+    char c = (i < text.length) ? text.start[i] : '\0';
+
+    // a name ending here sorts first in the range
+    if(i > 0 && pgm_read_byte(&table[first].name[i]) == '\0') {
+      char end = pgm_read_byte(&table[first].name[i - 1]);
+      if(c == '\0' || c == ' ' || !isAlphaNumeric(end)) {
+        match = first;
+        length = i;
+      }
+    }
+    if(c == '\0') break;
+
+    while(first <= last && (char)pgm_read_byte(&table[first].name[i]) < c) first++;
+    while(first <= last && (char)pgm_read_byte(&table[last].name[i]) > c) last--;
+  }
+  return match;
+}
+
+/*
+* Runs the command of the line from the table, false => no command matched
+* (for the caller to try other syntaxes). A matched command with the wrong
+* arguments is reported and not run.
+*/
+template<size_t N>
+bool runCommand(const Command (&table)[N], const char* line) {
+  TextSpan text = trimSpan(makeSpan(line, line + strlen(line)));
+  uint8_t length = 0;
+  int8_t index = matchTable(table, text, length);
+  if(index < 0) return false;
+
+  uint8_t schema = pgm_read_byte(&table[index].args);
+  uint8_t expected = schema & ~COMMAND_OPTIONAL;
+  int args[COMMAND_MAX_ARGS] = {0};
+  SpanSplitter splitter(makeSpan(text.start + length, text.start + text.length), ' ');
+  TextSpan token;
+  uint8_t count = 0;
+  bool valid = true;
+  while(splitter.next(token)) {
+    if(count >= expected || !spanToInt(token, args[count])) valid = false;
+    count++;
+  }
+
+  if(!valid || (count != expected && !(count == 0 && (schema & COMMAND_OPTIONAL)))) {
+    Serial.print(F("Invalid arguments for "));
+    printSpan(makeSpan(text.start, text.start + length));
+    Serial.println();
+    return true;
+  }
+
+  CommandHandler handler = (CommandHandler)pgm_read_ptr(&table[index].handler);
+  handler(args);
+  return true;
+}
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef CommandTokenizer_h
+#define CommandTokenizer_h
+
+#include <Arduino.h>
+
+// A view into a caller owned char buffer - nothing is copied or allocated
+struct TextSpan {
+  const char* start = nullptr;
+  uint8_t length = 0;
+};
+
+TextSpan makeSpan(const char* start, const char* end) {
+  TextSpan span;
+  span.start = start;
+  span.length = (end > start) ? (uint8_t)min((int)(end - start), 255) : 0;
+  return span;
+}
+
+TextSpan trimSpan(TextSpan span) {
+  while (span.length > 0 && isspace(span.start[0])) {
+    span.start++;
+    span.length--;
+  }
+  while (span.length > 0 && isspace(span.start[span.length-1])) {
+    span.length--;
+  }
+  return span;
+}
+
+bool spanEquals(TextSpan span, const char* text) {
+  uint8_t i = 0;
+  for (; i < span.length; i++) {
+    if (text[i] == '\0' || text[i] != span.start[i]) return false;
+  }
+  return text[i] == '\0';
+}
+
+int spanIndexOf(TextSpan span, char c) {
+  for (uint8_t i = 0; i < span.length; i++) {
+    if (span.start[i] == c) return i;
+  }
+  return -1;
+}
+
+void printSpan(TextSpan span) {
+  Serial.write((const uint8_t*)span.start, span.length);
+}
+
+// Same rules as tryGetInt: optional leading minus followed by digits only
+bool spanToInt(TextSpan span, int& value) {
+  value = 0;
+  span = trimSpan(span);
+  if (span.length == 0) return false;
+  uint8_t i = 0;
+  bool negative = false;
+  if (span.start[0] == '-') {
+    negative = true;
+    i = 1;
+    if (span.length == 1) return false;
+  }
+  for (; i < span.length; i++) {
+    if (!isDigit(span.start[i])) return false;
+    value = value * 10 + (span.start[i] - '0');
+  }
+  if (negative) value = -value;
+  return true;
+}
+
+// Same rules as tryParseInt: "0b..." or 16 binary digits, or "0x..." hex
+bool spanToSteps(TextSpan span, uint16_t& value) {
+  span = trimSpan(span);
+  value = 0;
+  bool binary = span.length == 16 || (span.length >= 2 && span.start[0] == '0' && span.start[1] == 'b');
+  if (binary) {
+    for (uint8_t i = 0; i < span.length; i++) {
+      char c = span.start[i];
+      if (c == '0' || c == '1') {
+        value = (value << 1) | (c - '0');
+      } else if (c != 'b') {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  if (span.length >= 2 && span.start[0] == '0' && span.start[1] == 'x') {
+    for (uint8_t i = 2; i < span.length; i++) {
+      char c = span.start[i];
+      uint8_t nibble;
+      if (c >= '0' && c <= '9') nibble = c - '0';
+      else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+      else break;
+      value = (value << 4) | nibble;
+    }
+    return true;
+  }
+
+  return false;
+}
+
+// Iterates the delimiter separated tokens of a span, skipping empty tokens
+class SpanSplitter {
+  private:
+    TextSpan _rest;
+    char _delimiter;
+
+  public:
+    SpanSplitter(TextSpan span, char delimiter) : _rest(span), _delimiter(delimiter) {}
+
+    bool next(TextSpan& token) {
+      while (_rest.length > 0) {
+        int pos = spanIndexOf(_rest, _delimiter);
+        uint8_t tokenLength = (pos == -1) ? _rest.length : pos;
+        token = trimSpan(makeSpan(_rest.start, _rest.start + tokenLength));
+        uint8_t consumed = (pos == -1) ? tokenLength : tokenLength + 1;
+        _rest.start += consumed;
+        _rest.length -= consumed;
+        if (token.length > 0) return true;
+      }
+      return false;
+    }
+};
+
+uint8_t countTokens(TextSpan span, char delimiter) {
+  SpanSplitter splitter(span, delimiter);
+  TextSpan token;
+  uint8_t count = 0;
+  while (splitter.next(token)) count++;
+  return count;
+}
+
+struct CommandTokens {
+  TextSpan partIndex;
+  TextSpan module;
+  TextSpan path;
+  TextSpan values;
+};
+
+/*
+* Splits a song command into its parts without allocating:
+*   0=2 0 2                 => part 0, no module, values "2 0 2"
+*   0:tempo=120             => part 0, module tempo, values "120"
+*   0:seq:0.last=31         => part 0, module seq, path "0.last", values "31"
+*/
+bool tokenizeCommand(const char* line, CommandTokens& tokens) {
+  tokens = CommandTokens();
+  TextSpan command = trimSpan(makeSpan(line, line + strlen(line)));
+  int pos = spanIndexOf(command, '=');
+  if (pos == -1) return false;
+
+  TextSpan head = makeSpan(command.start, command.start + pos);
+  tokens.values = trimSpan(makeSpan(command.start + pos + 1, command.start + command.length));
+
+  TextSpan fields[3];
+  uint8_t size = 0;
+  const char* fieldStart = head.start;
+  for (uint8_t i = 0; i <= head.length; i++) {
+    if (i == head.length || head.start[i] == ':') {
+      if (size == 3) return false;
+      fields[size++] = trimSpan(makeSpan(fieldStart, head.start + i));
+      fieldStart = head.start + i + 1;
+    }
+  }
+
+  tokens.partIndex = fields[0];
+  if (size >= 2) tokens.module = fields[1];
+  if (size == 3) tokens.path = fields[2];
+  return true;
+}
+
+#endif
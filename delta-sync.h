@@ -0,0 +1,97 @@
+#ifndef DeltaSync_h
+#define DeltaSync_h
+
+#include <Arduino.h>
+#include "i2c-scheduler.h"
+
+/*
+* Delta register sync.
+*
+* The master keeps a shadow of the registers each slave holds. When the
+* shadow is valid only the changed byte ranges are sent, each as one
+* transmission:
+*   "dlt" | part index | byte offset | changed bytes
+* A failed transmission invalidates the shadow so the next sync is a full
+* write again.
+*/
+
+#define DELTA_HEADER_SIZE 5
+#define DELTA_MAX_DATA (I2C_CHUNK_SIZE - DELTA_HEADER_SIZE) // a delta must never be split across transmissions
+#define DELTA_MERGE_GAP DELTA_HEADER_SIZE // unchanged gaps shorter than a header are cheaper to resend
+
+struct RegisterShadow {
+  uint8_t* data;
+  uint8_t size;
+  bool valid;
+};
+
+struct DeltaSyncStats {
+  unsigned long full;
+  unsigned long deltas;
+  unsigned long unchanged;
+  unsigned long bytesSent;
+  unsigned long bytesSkipped;
+};
+
+DeltaSyncStats deltaSyncStats = {0, 0, 0, 0, 0};
+
+// Queues the changed ranges of current vs. shadow and updates the shadow.
+// Returns the number of data bytes queued.
+uint8_t queueDelta(uint8_t address, uint8_t part, const uint8_t* current, RegisterShadow& shadow,
+                   uint8_t priority, unsigned long deadline, I2CCompleted onCompleted, uint8_t tag) {
+  uint8_t queued = 0;
+  uint8_t i = 0;
+  while (i < shadow.size) {
+    if (current[i] == shadow.data[i]) {
+      i++;
+      continue;
+    }
+
+    // extend the range while changes are close enough together
+    uint8_t start = i;
+    uint8_t end = i + 1;
+    uint8_t j = end;
+    while (j < shadow.size && (j - start) < DELTA_MAX_DATA) {
+      if (current[j] != shadow.data[j]) {
+        end = j + 1;
+      } else if (j - end >= DELTA_MERGE_GAP) {
+        break;
+      }
+      j++;
+    }
+
+    uint8_t length = end - start;
+    uint8_t buffer[I2C_CHUNK_SIZE];
+    memcpy(buffer, "dlt", 3);
+    buffer[3] = part;
+    buffer[4] = start;
+    memcpy(&buffer[DELTA_HEADER_SIZE], &current[start], length);
+    i2cScheduler.enqueue(address, buffer, DELTA_HEADER_SIZE + length, priority, deadline, onCompleted, tag);
+
+    memcpy(&shadow.data[start], &current[start], length);
+    queued += length;
+    i = end;
+  }
+
+  if (queued == 0) deltaSyncStats.unchanged++;
+  else deltaSyncStats.deltas++;
+  deltaSyncStats.bytesSent += queued;
+  deltaSyncStats.bytesSkipped += shadow.size - queued;
+  return queued;
+}
+
+void acceptFull(const uint8_t* current, RegisterShadow& shadow) {
+  memcpy(shadow.data, current, shadow.size);
+  shadow.valid = true;
+  deltaSyncStats.full++;
+  deltaSyncStats.bytesSent += shadow.size;
+}
+
+void printDeltaSyncStats() {
+  char s[100];
+  sprintf_P(s, PSTR("delta sync => full: %lu | delta: %lu | unchanged: %lu | bytes sent: %lu | bytes skipped: %lu"),
+          deltaSyncStats.full, deltaSyncStats.deltas, deltaSyncStats.unchanged, deltaSyncStats.bytesSent, deltaSyncStats.bytesSkipped);
+  Serial.println(s);
+}
+
+#endif
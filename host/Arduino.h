@@ -0,0 +1,461 @@
+#ifndef HostArduino_h
+#define HostArduino_h
+
+/*
+* Host (Linux) stand-in for the Arduino core.
+*
+* Time is virtual: millis()/micros() only move when the shim charges an
+* operation (digital io, analogRead, i2c bytes, eeprom writes, delay) or when
+* the host runner advances the clock between loop() passes. The costs below
+* approximate an ATmega2560 at 16 MHz so loop timings measured on the host
+* are in the right ballpark.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <string>
+#include <deque>
+
+#include "binary.h"
+
+#define HOST_COST_DIGITAL_WRITE_NS 3500
+#define HOST_COST_DIGITAL_READ_NS 3000
+#define HOST_COST_ANALOG_READ_NS 112000
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef unsigned int word;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define NUM_DIGITAL_PINS 70
+#define NUM_ANALOG_INPUTS 16
+
+#define A0 54
+#define A1 55
+#define A2 56
+#define A3 57
+#define A4 58
+#define A5 59
+#define A6 60
+#define A7 61
+
+#ifndef min
+#define min(a,b) ((a)<(b)?(a):(b))
+#endif
+#ifndef max
+#define max(a,b) ((a)>(b)?(a):(b))
+#endif
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_ptr(addr) (*(void* const*)(addr))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcpy_P strcpy
+#define memcpy_P memcpy
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(string_literal))
+
+// ---------------------------------------------------------------- virtual clock
+
+uint64_t hostNanos = 0;
+
+typedef void (*HostInterruptHandler)();
+
+struct HostPulseTrain {
+  uint8_t pin;
+  uint64_t periodNs;
+  uint64_t nextEdgeNs;
+  bool active;
+};
+
+HostPulseTrain hostPulseTrain = {0, 0, 0, false};
+HostInterruptHandler hostInterruptHandlers[6] = {nullptr};
+int hostInterruptModes[6] = {0};
+bool hostInterruptsEnabled = true;
+uint8_t hostPendingInterrupts = 0;
+uint8_t hostDigitalPins[NUM_DIGITAL_PINS] = {0};
+uint16_t hostAnalogPins[NUM_ANALOG_INPUTS] = {0};
+
+int digitalPinToInterrupt(uint8_t pin) {
+  switch (pin) {
+    case 2: return 0;
+    case 3: return 1;
+    case 21: return 2;
+    case 20: return 3;
+    case 19: return 4;
+    case 18: return 5;
+    default: return -1;
+  }
+}
+
+void hostFireInterrupt(int number) {
+  if (number < 0 || number >= 6 || !hostInterruptHandlers[number]) return;
+  if (!hostInterruptsEnabled) {
+    hostPendingInterrupts |= (1 << number);
+    return;
+  }
+  hostInterruptHandlers[number]();
+}
+
+// Drive a pin from the host side, firing an attached interrupt on a matching edge
+void hostSetPin(uint8_t pin, uint8_t value) {
+  if (pin >= NUM_DIGITAL_PINS) return;
+  uint8_t previous = hostDigitalPins[pin];
+  hostDigitalPins[pin] = value ? HIGH : LOW;
+  int number = digitalPinToInterrupt(pin);
+  if (number < 0 || previous == hostDigitalPins[pin]) return;
+  int mode = hostInterruptModes[number];
+  bool rising = hostDigitalPins[pin] == HIGH;
+  if (mode == CHANGE || (mode == RISING && rising) || (mode == FALLING && !rising))
+    hostFireInterrupt(number);
+}
+
+void hostSetAnalog(uint8_t pin, uint16_t value) {
+  if (pin >= A0) pin -= A0;
+  if (pin < NUM_ANALOG_INPUTS) hostAnalogPins[pin] = value;
+}
+
+// Periodic rising edges on a pin, e.g. the clock input at a given bpm/ppqn
+void hostStartPulseTrain(uint8_t pin, uint64_t periodNs) {
+  hostPulseTrain.pin = pin;
+  hostPulseTrain.periodNs = periodNs;
+  hostPulseTrain.nextEdgeNs = hostNanos + periodNs;
+  hostPulseTrain.active = periodNs > 0;
+}
+
+void hostStopPulseTrain() {
+  hostPulseTrain.active = false;
+}
+
+void hostAdvanceNanos(uint64_t ns) {
+  uint64_t target = hostNanos + ns;
+  while (hostPulseTrain.active && hostPulseTrain.nextEdgeNs <= target) {
+    hostNanos = hostPulseTrain.nextEdgeNs;
+    hostPulseTrain.nextEdgeNs += hostPulseTrain.periodNs;
+    hostSetPin(hostPulseTrain.pin, HIGH);
+    hostSetPin(hostPulseTrain.pin, LOW);
+  }
+  hostNanos = target;
+}
+
+unsigned long millis() { return (unsigned long)(hostNanos / 1000000ULL); }
+unsigned long micros() { return (unsigned long)(hostNanos / 1000ULL); }
+void delay(unsigned long ms) { hostAdvanceNanos((uint64_t)ms * 1000000ULL); }
+void delayMicroseconds(unsigned int us) { hostAdvanceNanos((uint64_t)us * 1000ULL); }
+
+void noInterrupts() { hostInterruptsEnabled = false; }
+
+void interrupts() {
+  hostInterruptsEnabled = true;
+  uint8_t pending = hostPendingInterrupts;
+  hostPendingInterrupts = 0;
+  for (int i = 0; i < 6; i++) {
+    if (pending & (1 << i)) hostFireInterrupt(i);
+  }
+}
+
+#define cli() noInterrupts()
+#define sei() interrupts()
+
+void attachInterrupt(int number, HostInterruptHandler handler, int mode) {
+  if (number < 0 || number >= 6) return;
+  hostInterruptHandlers[number] = handler;
+  hostInterruptModes[number] = mode;
+}
+
+void detachInterrupt(int number) {
+  if (number < 0 || number >= 6) return;
+  hostInterruptHandlers[number] = nullptr;
+}
+
+// ---------------------------------------------------------------- io
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < NUM_DIGITAL_PINS && mode == INPUT_PULLUP) hostDigitalPins[pin] = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  hostAdvanceNanos(HOST_COST_DIGITAL_WRITE_NS);
+  if (pin < NUM_DIGITAL_PINS) hostDigitalPins[pin] = value ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) {
+  hostAdvanceNanos(HOST_COST_DIGITAL_READ_NS);
+  return (pin < NUM_DIGITAL_PINS) ? hostDigitalPins[pin] : LOW;
+}
+
+// what the ADC would convert, without charging a blocking analogRead
+uint16_t hostAnalogValue(uint8_t pin) {
+  if (pin >= A0) pin -= A0;
+  return (pin < NUM_ANALOG_INPUTS) ? hostAnalogPins[pin] : 0;
+}
+
+int analogRead(uint8_t pin) {
+  hostAdvanceNanos(HOST_COST_ANALOG_READ_NS);
+  if (pin >= A0) pin -= A0;
+  return (pin < NUM_ANALOG_INPUTS) ? hostAnalogPins[pin] : 0;
+}
+
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val) {
+  for (uint8_t i = 0; i < 8; i++) {
+    if (bitOrder == LSBFIRST)
+      digitalWrite(dataPin, !!(val & (1 << i)));
+    else
+      digitalWrite(dataPin, !!(val & (1 << (7 - i))));
+    digitalWrite(clockPin, HIGH);
+    digitalWrite(clockPin, LOW);
+  }
+}
+
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+inline bool isDigit(int c) { return isdigit(c) != 0; }
+inline bool isSpace(int c) { return isspace(c) != 0; }
+inline bool isAlpha(int c) { return isalpha(c) != 0; }
+inline bool isAlphaNumeric(int c) { return isalnum(c) != 0; }
+
+// ---------------------------------------------------------------- String
+
+class String {
+  private:
+    std::string _s;
+
+    static std::string fromNumber(unsigned long value, bool negative, int base) {
+      if (base < 2) base = 10;
+      std::string digits;
+      do {
+        int d = value % base;
+        digits.insert(digits.begin(), (char)(d < 10 ? '0' + d : 'a' + d - 10));
+        value /= base;
+      } while (value > 0);
+      if (negative) digits.insert(digits.begin(), '-');
+      return digits;
+    }
+
+  public:
+    String() {}
+    String(const char* s) : _s(s ? s : "") {}
+    String(const std::string& s) : _s(s) {}
+    String(const __FlashStringHelper* s) : _s(reinterpret_cast<const char*>(s)) {}
+    explicit String(char c) : _s(1, c) {}
+    String(unsigned char value, int base = DEC) : _s(fromNumber(value, false, base)) {}
+    String(int value, int base = DEC) : _s(base == DEC ? fromNumber(value < 0 ? -(long)value : value, value < 0, base) : fromNumber((unsigned int)value, false, base)) {}
+    String(unsigned int value, int base = DEC) : _s(fromNumber(value, false, base)) {}
+    String(long value, int base = DEC) : _s(base == DEC ? fromNumber(value < 0 ? -value : value, value < 0, base) : fromNumber((unsigned long)value, false, base)) {}
+    String(unsigned long value, int base = DEC) : _s(fromNumber(value, false, base)) {}
+    String(double value, int decimals = 2) {
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+      _s = buffer;
+    }
+
+    unsigned int length() const { return _s.length(); }
+    const char* c_str() const { return _s.c_str(); }
+    char charAt(unsigned int index) const { return index < _s.length() ? _s[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index) { return _s[index]; }
+
+    String substring(unsigned int from) const {
+      return from < _s.length() ? String(_s.substr(from)) : String();
+    }
+    String substring(unsigned int from, unsigned int to) const {
+      if (from > to) { unsigned int t = from; from = to; to = t; }
+      if (from >= _s.length()) return String();
+      return String(_s.substr(from, to - from));
+    }
+
+    int indexOf(char c, unsigned int from = 0) const {
+      size_t pos = _s.find(c, from);
+      return pos == std::string::npos ? -1 : (int)pos;
+    }
+    int indexOf(const String& s, unsigned int from = 0) const {
+      size_t pos = _s.find(s._s, from);
+      return pos == std::string::npos ? -1 : (int)pos;
+    }
+
+    bool startsWith(const String& prefix) const { return _s.compare(0, prefix._s.length(), prefix._s) == 0; }
+    bool endsWith(const String& suffix) const {
+      return _s.length() >= suffix._s.length() && _s.compare(_s.length() - suffix._s.length(), suffix._s.length(), suffix._s) == 0;
+    }
+
+    void trim() {
+      size_t start = 0;
+      while (start < _s.length() && isspace((unsigned char)_s[start])) start++;
+      size_t end = _s.length();
+      while (end > start && isspace((unsigned char)_s[end - 1])) end--;
+      _s = _s.substr(start, end - start);
+    }
+
+    long toInt() const { return atol(_s.c_str()); }
+    float toFloat() const { return (float)atof(_s.c_str()); }
+
+    String& operator+=(const String& s) { _s += s._s; return *this; }
+    String& operator+=(const char* s) { _s += s; return *this; }
+    String& operator+=(char c) { _s += c; return *this; }
+    String& operator+=(int value) { _s += String(value)._s; return *this; }
+
+    bool operator==(const String& s) const { return _s == s._s; }
+    bool operator==(const char* s) const { return _s == s; }
+    bool operator!=(const String& s) const { return _s != s._s; }
+    bool operator!=(const char* s) const { return _s != s; }
+
+    friend String operator+(const String& a, const String& b) { return String(a._s + b._s); }
+    friend String operator+(const String& a, const char* b) { return String(a._s + b); }
+    friend String operator+(const char* a, const String& b) { return String(a + b._s); }
+    friend String operator+(const String& a, char b) { return String(a._s + b); }
+};
+
+// ---------------------------------------------------------------- Print / Stream / Serial
+
+class Print {
+  private:
+    size_t printNumber(unsigned long n, uint8_t base) {
+      return print(String(n, base == 0 ? DEC : base));
+    }
+
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+      size_t n = 0;
+      while (size--) n += write(*buffer++);
+      return n;
+    }
+    size_t write(const char* s) { return s ? write((const uint8_t*)s, strlen(s)) : 0; }
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const __FlashStringHelper* s) { return write(reinterpret_cast<const char*>(s)); }
+    size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+    size_t print(const char* s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return printNumber(n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return printNumber(n, base); }
+    size_t print(long n, int base = DEC) {
+      if (base == DEC) return print(String(n));
+      return printNumber((unsigned long)n, base);
+    }
+    size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+    size_t print(double n, int digits = 2) { return print(String(n, digits)); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+};
+
+class Stream : public Print {
+  protected:
+    unsigned long _timeout = 1000;
+
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+
+    size_t readBytes(char* buffer, size_t length) {
+      size_t count = 0;
+      while (count < length && available() > 0) {
+        buffer[count++] = (char)read();
+      }
+      return count;
+    }
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+    // Like the real core, a missing terminator costs the full timeout
+    String readStringUntil(char terminator) {
+      String result;
+      while (available() > 0) {
+        int c = read();
+        if (c == terminator) return result;
+        result += (char)c;
+      }
+      delay(_timeout);
+      return result;
+    }
+
+    String readString() {
+      String result;
+      while (available() > 0) result += (char)read();
+      delay(_timeout);
+      return result;
+    }
+};
+
+class HardwareSerial : public Stream {
+  private:
+    std::deque<uint8_t> _input;
+    unsigned long _baud = 0;
+    FILE* _out = stdout;
+
+  public:
+    void begin(unsigned long baud) { _baud = baud; }
+    void end() {}
+    operator bool() const { return true; }
+
+    int available() override { return (int)_input.size(); }
+    int read() override {
+      if (_input.empty()) return -1;
+      int c = _input.front();
+      _input.pop_front();
+      return c;
+    }
+    int peek() override { return _input.empty() ? -1 : _input.front(); }
+    int availableForWrite() override { return 63; }
+
+    size_t write(uint8_t c) override {
+      fputc(c, _out);
+      return 1;
+    }
+    using Print::write;
+    void flush() override { fflush(_out); }
+
+    // host side: queue bytes as if they arrived from the usb serial
+    void hostInput(const char* data, size_t length) {
+      for (size_t i = 0; i < length; i++) _input.push_back((uint8_t)data[i]);
+    }
+    void hostInput(const char* data) { hostInput(data, strlen(data)); }
+    void hostSetOutput(FILE* out) { _out = out; }
+};
+
+HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef HostEEPROM_h
+#define HostEEPROM_h
+
+#include "Arduino.h"
+
+#define HOST_EEPROM_SIZE 4096
+#define E2END (HOST_EEPROM_SIZE - 1) // last EEPROM address, from avr/io.h on the Mega
+#define HOST_COST_EEPROM_WRITE_NS 3300000 // the cell programming time, runs in the background
+#define HOST_COST_EEPROM_START_NS 2000
+#define HOST_COST_EEPROM_READ_NS 500
+
+// In-memory EEPROM of an ATmega2560, erased to 0xFF. Like the real one a
+// write starts the programming and returns; the next read or write waits
+// until it is done (see eeprom_is_ready()).
+class EEPROMClass {
+  private:
+    uint8_t _data[HOST_EEPROM_SIZE];
+    uint64_t _readyAtNs = 0;
+
+    void busyWait() {
+      if (hostNanos < _readyAtNs) hostAdvanceNanos(_readyAtNs - hostNanos);
+    }
+
+  public:
+    unsigned long writes = 0;
+
+    EEPROMClass() { memset(_data, 0xFF, sizeof(_data)); }
+
+    bool ready() { return hostNanos >= _readyAtNs; }
+
+    uint8_t read(int address) {
+      busyWait();
+      hostAdvanceNanos(HOST_COST_EEPROM_READ_NS);
+      return (address >= 0 && address < HOST_EEPROM_SIZE) ? _data[address] : 0xFF;
+    }
+
+    void write(int address, uint8_t value) {
+      busyWait();
+      hostAdvanceNanos(HOST_COST_EEPROM_START_NS);
+      _readyAtNs = hostNanos + HOST_COST_EEPROM_WRITE_NS;
+      if (address < 0 || address >= HOST_EEPROM_SIZE) return;
+      _data[address] = value;
+      writes++;
+    }
+
+    void update(int address, uint8_t value) {
+      if (read(address) != value) write(address, value);
+    }
+
+    template <typename T> T& get(int address, T& value) {
+      uint8_t* p = (uint8_t*)&value;
+      for (size_t i = 0; i < sizeof(T); i++) p[i] = read(address + i);
+      return value;
+    }
+
+    template <typename T> const T& put(int address, const T& value) {
+      const uint8_t* p = (const uint8_t*)&value;
+      for (size_t i = 0; i < sizeof(T); i++) update(address + i, p[i]);
+      return value;
+    }
+
+    uint16_t length() { return HOST_EEPROM_SIZE; }
+
+    // host side: persist the image between runs
+    bool hostLoad(const char* filename) {
+      FILE* f = fopen(filename, "rb");
+      if (!f) return false;
+      size_t n = fread(_data, 1, sizeof(_data), f);
+      fclose(f);
+      return n == sizeof(_data);
+    }
+
+    bool hostSave(const char* filename) {
+      FILE* f = fopen(filename, "wb");
+      if (!f) return false;
+      size_t n = fwrite(_data, 1, sizeof(_data), f);
+      fclose(f);
+      return n == sizeof(_data);
+    }
+};
+
+EEPROMClass EEPROM;
+
+// <avr/eeprom.h>
+#define eeprom_is_ready() EEPROM.ready()
+#define eeprom_busy_wait() EEPROM.read(0)
+
+#endif
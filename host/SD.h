@@ -0,0 +1,68 @@
+#ifndef HostSD_h
+#define HostSD_h
+
+#include "Arduino.h"
+#include <map>
+
+#define FILE_READ 0x01
+#define FILE_WRITE 0x13
+
+// In-memory SD card: one std::string pr filename
+std::map<std::string, std::string> hostSDFiles;
+
+class File : public Stream {
+  private:
+    std::string _name;
+    size_t _position = 0;
+    bool _open = false;
+
+  public:
+    File() {}
+    File(const char* name, uint8_t mode) : _name(name), _open(true) {
+      if (mode == FILE_WRITE) _position = hostSDFiles[_name].size();
+    }
+
+    operator bool() const { return _open; }
+    const char* name() const { return _name.c_str(); }
+    void close() { _open = false; }
+
+    int available() override {
+      if (!_open) return 0;
+      return (int)(hostSDFiles[_name].size() - _position);
+    }
+    int read() override {
+      if (available() <= 0) return -1;
+      return (uint8_t)hostSDFiles[_name][_position++];
+    }
+    int peek() override {
+      if (available() <= 0) return -1;
+      return (uint8_t)hostSDFiles[_name][_position];
+    }
+
+    size_t write(uint8_t c) override {
+      if (!_open) return 0;
+      std::string& data = hostSDFiles[_name];
+      if (_position >= data.size()) data.push_back((char)c);
+      else data[_position] = (char)c;
+      _position++;
+      return 1;
+    }
+    using Print::write;
+};
+
+class SDClass {
+  public:
+    bool begin(uint8_t csPin = 53) { return true; }
+    bool exists(const char* filename) { return hostSDFiles.count(filename) > 0; }
+    bool remove(const char* filename) { return hostSDFiles.erase(filename) > 0; }
+
+    File open(const char* filename, uint8_t mode = FILE_READ) {
+      if (mode != FILE_WRITE && !exists(filename)) return File();
+      if (mode == FILE_WRITE) hostSDFiles[filename];
+      return File(filename, mode);
+    }
+};
+
+SDClass SD;
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef HostSPI_h
+#define HostSPI_h
+
+#include "Arduino.h"
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+struct SPISettings {
+  uint32_t clock;
+  uint8_t bitOrder;
+  uint8_t dataMode;
+
+  SPISettings() : clock(4000000), bitOrder(MSBFIRST), dataMode(SPI_MODE0) {}
+  SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) : clock(clock), bitOrder(bitOrder), dataMode(dataMode) {}
+};
+
+typedef uint8_t (*HostSPITransfer)(uint8_t data);
+
+// SPI bus charging 8 clocks pr byte; MISO comes from an optional host device
+class SPIClass {
+  private:
+    uint32_t _clock = 4000000;
+    HostSPITransfer _device = nullptr;
+
+  public:
+    unsigned long bytesTransferred = 0;
+
+    void begin() {}
+    void end() {}
+
+    void beginTransaction(SPISettings settings) { _clock = settings.clock; }
+    void endTransaction() {}
+
+    uint8_t transfer(uint8_t data) {
+      hostAdvanceNanos(8ULL * 1000000000ULL / _clock);
+      bytesTransferred++;
+      return _device ? _device(data) : 0;
+    }
+
+    void transfer(void* buffer, size_t count) {
+      uint8_t* p = (uint8_t*)buffer;
+      for (size_t i = 0; i < count; i++) p[i] = transfer(p[i]);
+    }
+
+    void hostAttachDevice(HostSPITransfer device) { _device = device; }
+};
+
+SPIClass SPI;
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef HostWire_h
+#define HostWire_h
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH 32
+#define HOST_I2C_SLAVES 128
+
+/*
+* In-memory i2c bus. A slave is a pair of callbacks registered on an address;
+* transactions to addresses without a slave fail like a NACK on the real bus.
+* Every transaction charges the virtual clock for the bits on the wire.
+*/
+
+typedef void (*HostI2CReceive)(uint8_t address, const uint8_t* data, size_t length);
+typedef size_t (*HostI2CRequest)(uint8_t address, uint8_t* data, size_t length);
+
+struct HostI2CStats {
+  unsigned long transmissions;
+  unsigned long requests;
+  unsigned long bytesWritten;
+  unsigned long bytesRead;
+  unsigned long errors;
+};
+
+class TwoWire : public Stream {
+  private:
+    HostI2CReceive _receive[HOST_I2C_SLAVES] = {nullptr};
+    HostI2CRequest _request[HOST_I2C_SLAVES] = {nullptr};
+
+    uint32_t _clock = 100000;
+    uint8_t _txAddress = 0;
+    uint8_t _txBuffer[BUFFER_LENGTH];
+    size_t _txLength = 0;
+    uint8_t _rxBuffer[BUFFER_LENGTH];
+    size_t _rxLength = 0;
+    size_t _rxIndex = 0;
+
+    void chargeBus(size_t bytes) {
+      // start + address + data bytes, 9 clocks each including ack
+      hostAdvanceNanos((uint64_t)(bytes + 1) * 9 * 1000000000ULL / _clock);
+    }
+
+  public:
+    HostI2CStats stats = {0, 0, 0, 0, 0};
+
+    void begin() {}
+    void setClock(uint32_t clock) { _clock = clock; }
+
+    void beginTransmission(int address) {
+      _txAddress = (uint8_t)address;
+      _txLength = 0;
+    }
+
+    size_t write(uint8_t data) override {
+      if (_txLength >= BUFFER_LENGTH) return 0;
+      _txBuffer[_txLength++] = data;
+      return 1;
+    }
+    size_t write(const uint8_t* data, size_t length) override {
+      size_t n = 0;
+      while (n < length && write(data[n])) n++;
+      return n;
+    }
+    using Print::write;
+
+    uint8_t endTransmission(bool = true) {
+      chargeBus(_txLength);
+      stats.transmissions++;
+      if (_txAddress >= HOST_I2C_SLAVES || !_receive[_txAddress]) {
+        stats.errors++;
+        return 2; // address NACK
+      }
+      stats.bytesWritten += _txLength;
+      _receive[_txAddress](_txAddress, _txBuffer, _txLength);
+      return 0;
+    }
+
+    uint8_t requestFrom(int address, int quantity) {
+      _rxIndex = 0;
+      _rxLength = 0;
+      if (quantity > BUFFER_LENGTH) quantity = BUFFER_LENGTH;
+      stats.requests++;
+      if (address < 0 || address >= HOST_I2C_SLAVES || !_request[address]) {
+        chargeBus(0);
+        stats.errors++;
+        return 0;
+      }
+      _rxLength = _request[address]((uint8_t)address, _rxBuffer, quantity);
+      chargeBus(_rxLength);
+      stats.bytesRead += _rxLength;
+      return (uint8_t)_rxLength;
+    }
+
+    int available() override { return (int)(_rxLength - _rxIndex); }
+    int read() override { return (_rxIndex < _rxLength) ? _rxBuffer[_rxIndex++] : -1; }
+    int peek() override { return (_rxIndex < _rxLength) ? _rxBuffer[_rxIndex] : -1; }
+
+    // host side: attach a simulated slave
+    void hostAttachSlave(uint8_t address, HostI2CReceive receive, HostI2CRequest request) {
+      if (address >= HOST_I2C_SLAVES) return;
+      _receive[address] = receive;
+      _request[address] = request;
+    }
+};
+
+TwoWire Wire;
+
+#endif
@@ -0,0 +1,279 @@
+/*
+* Deterministic clock simulation of Channel chaining.
+*
+* Drives virtual 24 PPQN pulses through the sketch's Channel and
+* SongTransport objects for randomized songs, records every start, stop,
+* before-completed and completed event with its pulse number and checks the
+* recording against the timeline the song should produce:
+*
+*   a part with lastStep L-1 and R repeats (0 counts as 1) started on a
+*   downbeat at pulse P fires before-completed at P+6RL-2, completed at
+*   P+6RL-1 and is stopped - and its chain target started - on the next
+*   downbeat at P+24*ceil(RL/4).
+*
+* build (from the repository root):
+*   g++ -std=gnu++17 -O2 -g -fpermissive -w -Ihost host/clock-sim.cpp -o clock-sim
+*
+* usage:
+*   ./clock-sim [--songs N] [--seed S] [--bpm B] [--verbose]
+*
+* The precomputed SongTimeline of every song is checked against the same
+* expected timeline, and every song is played again after seeking to a
+* random bar - from there on it must follow the same timeline.
+*
+* Exits with 1 if any song deviates from its expected timeline.
+*/
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <Arduino.h> // after the standard headers - it defines min/max macros like the real core
+
+#include "../shared.h"
+#include "../channel.h"
+#include "../song-transport.h"
+#include "../song-timeline.h"
+
+#define MAX_PART_PLAYS 32  // chain cycles are cut off here
+#define MAX_SONG_PULSES 200000
+
+enum SimEventType { EV_START, EV_STOP, EV_BEFORE, EV_COMPLETE };
+const char* const simEventNames[] = {"start", "stop", "before", "complete"};
+
+struct SimEvent {
+  unsigned long pulse;
+  uint8_t type;
+  uint8_t channel;
+
+  bool operator==(const SimEvent& other) const {
+    return pulse == other.pulse && type == other.type && channel == other.channel;
+  }
+};
+
+struct SimPart {
+  uint8_t lastStep;
+  uint8_t repeats;
+  int8_t chainTo;
+};
+
+struct SimSong {
+  SimPart parts[CHANNELS];
+  uint8_t firstPart;
+};
+
+Channel channels[CHANNELS];
+SongTransport transport(channels);
+SongTimeline timeline;
+std::vector<SimEvent> recorded;
+unsigned long simPulse = 0;
+int partPlays = 0;
+
+void record(uint8_t type, uint8_t channel) {
+  recorded.push_back({simPulse, type, channel});
+}
+
+void onSimPartCompleted(uint8_t channelNumber, uint8_t chainTo) {
+  record(EV_COMPLETE, channelNumber);
+  transport.PartCompleted(channelNumber, (int8_t)chainTo);
+}
+
+void onSimBeforePartCompleted(uint8_t channelNumber, uint8_t) { record(EV_BEFORE, channelNumber); }
+void onSimPartStarted(uint8_t channelNumber) { record(EV_START, channelNumber); partPlays++; }
+void onSimPartStopped(uint8_t channelNumber) { record(EV_STOP, channelNumber); }
+
+SimSong randomSong(std::mt19937& rng) {
+  SimSong song;
+  for (int i = 0; i < CHANNELS; i++) {
+    // mostly whole pages, sometimes an odd last step to exercise the downbeat rounding
+    if (rng() % 4 == 0) song.parts[i].lastStep = rng() % 64;
+    else song.parts[i].lastStep = (1 + rng() % 4) * 16 - 1;
+    song.parts[i].repeats = rng() % 9;
+    song.parts[i].chainTo = (int8_t)(rng() % (CHANNELS + 3)) - 1; // -1, 0..7 and a few out of range targets
+  }
+  song.firstPart = rng() % CHANNELS;
+  return song;
+}
+
+std::vector<SimEvent> expectedTimeline(const SimSong& song) {
+  std::vector<SimEvent> events;
+  unsigned long start = 0;
+  int8_t part = song.firstPart;
+  for (int plays = 0; plays < MAX_PART_PLAYS && part >= 0 && part < CHANNELS; plays++) {
+    const SimPart& p = song.parts[part];
+    unsigned long steps = (unsigned long)(p.lastStep + 1) * max(p.repeats, 1);
+    unsigned long stop = start + 24 * ((steps + 3) / 4);
+    events.push_back({start, EV_START, (uint8_t)part});
+    events.push_back({start + 6 * steps - 2, EV_BEFORE, (uint8_t)part});
+    events.push_back({start + 6 * steps - 1, EV_COMPLETE, (uint8_t)part});
+    events.push_back({stop, EV_STOP, (uint8_t)part});
+    start = stop;
+    part = p.chainTo;
+  }
+  return events;
+}
+
+// returns the number of pulses simulated - seekPulse > 0 jumps there (a bar start) instead of starting the first part
+unsigned long simulate(const SimSong& song, unsigned long seekPulse = 0) {
+  recorded.clear();
+  simPulse = 0;
+  partPlays = 0;
+  transport.Reset();
+  for (int i = 0; i < CHANNELS; i++) {
+    channels[i].Reset();
+    channels[i].SetLastStep(song.parts[i].lastStep);
+    channels[i].SetRepeats(song.parts[i].repeats);
+    channels[i].SetChainTo(song.parts[i].chainTo);
+  }
+
+  if (seekPulse > 0) {
+    unsigned long offset = 0;
+    timeline.Build(channels, song.firstPart);
+    int8_t entry = timeline.Locate(seekPulse, offset);
+    simPulse = seekPulse;
+    transport.StartAt(timeline.Entry(entry).part, offset / 6);
+  } else {
+    channels[song.firstPart].Start();
+  }
+  while (simPulse < seekPulse + MAX_SONG_PULSES) {
+    simPulse++;
+    transport.Pulse();
+
+    bool playing = false;
+    for (int i = 0; i < CHANNELS; i++) playing |= channels[i].IsStarted();
+    if (!playing || partPlays > MAX_PART_PLAYS) break;
+  }
+  return simPulse;
+}
+
+void printSong(const SimSong& song) {
+  printf("  first part %d\n", song.firstPart);
+  for (int i = 0; i < CHANNELS; i++) {
+    printf("  part %d => laststep: %2d | repeats: %d | chainTo: %d\n", i, song.parts[i].lastStep, song.parts[i].repeats, song.parts[i].chainTo);
+  }
+}
+
+void printEvents(const char* title, const std::vector<SimEvent>& events, size_t count) {
+  printf("  %s:", title);
+  for (size_t i = 0; i < count && i < events.size(); i++) {
+    printf(" %s(%d)@%lu", simEventNames[events[i].type], events[i].channel, events[i].pulse);
+  }
+  printf("\n");
+}
+
+// every expected play starts where the timeline locates the start of its part, and a song that ends ends at its duration
+bool timelineMatches(const std::vector<SimEvent>& expected) {
+  timeline.Build(channels, expected.empty() ? -1 : expected[0].channel);
+  unsigned long offset = 0;
+  for (size_t i = 0; i < expected.size(); i += 4) {
+    int8_t entry = timeline.Locate(expected[i].pulse, offset);
+    if (entry < 0 || offset != 0 || timeline.Entry(entry).part != expected[i].channel) return false;
+  }
+  if (expected.size() / 4 >= MAX_PART_PLAYS) return timeline.Loops();
+  return !timeline.Loops() && timeline.Duration() == expected.back().pulse
+      && timeline.Locate(timeline.Duration(), offset) == -1;
+}
+
+bool matches(const std::vector<SimEvent>& expected, size_t& mismatch) {
+  // with a cut off cycle the recording may end in the middle of the last play
+  size_t count = min(expected.size(), recorded.size());
+  for (mismatch = 0; mismatch < count; mismatch++) {
+    if (!(expected[mismatch] == recorded[mismatch])) return false;
+  }
+  return expected.size() == recorded.size() || partPlays > MAX_PART_PLAYS;
+}
+
+// the part playing at the seek pulse starts there, everything after it is unchanged
+std::vector<SimEvent> expectedAfterSeek(const std::vector<SimEvent>& expected, unsigned long seekPulse) {
+  std::vector<SimEvent> events;
+  for (size_t i = 0; i < expected.size(); i += 4) {
+    if (expected[i + 3].pulse <= seekPulse) continue;
+    if (events.empty()) events.push_back({seekPulse, EV_START, expected[i].channel});
+    for (size_t j = i; j < i + 4; j++) {
+      if (expected[j].pulse > seekPulse) events.push_back(expected[j]);
+    }
+  }
+  return events;
+}
+
+int main(int argc, char** argv) {
+  unsigned long songs = 10000;
+  unsigned long seed = 1;
+  double bpm = 120;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--songs") && i + 1 < argc) songs = strtoul(argv[++i], nullptr, 10);
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc) seed = strtoul(argv[++i], nullptr, 10);
+    else if (!strcmp(argv[i], "--bpm") && i + 1 < argc) bpm = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--verbose")) verbose = true;
+    else {
+      fprintf(stderr, "usage: %s [--songs N] [--seed S] [--bpm B] [--verbose]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  for (int i = 0; i < CHANNELS; i++) {
+    channels[i] = Channel(i, 7 - i);
+    channels[i].OnPartCompleted(onSimPartCompleted);
+    channels[i].OnBeforePartCompleted(onSimBeforePartCompleted);
+    channels[i].OnPartStarted(onSimPartStarted);
+    channels[i].OnPartStopped(onSimPartStopped);
+  }
+
+  std::mt19937 rng(seed);
+  unsigned long failures = 0;
+  unsigned long timelineFailures = 0;
+  unsigned long seekFailures = 0;
+  unsigned long long totalPulses = 0;
+  unsigned long long seekPulses = 0;
+  auto begin = std::chrono::steady_clock::now();
+
+  for (unsigned long n = 0; n < songs; n++) {
+    SimSong song = randomSong(rng);
+    totalPulses += simulate(song);
+    std::vector<SimEvent> expected = expectedTimeline(song);
+
+    if (!timelineMatches(expected)) {
+      timelineFailures++;
+      if (verbose || timelineFailures <= 3) {
+        printf("song %lu: precomputed timeline deviates\n", n);
+        printSong(song);
+        printEvents("expected", expected, expected.size());
+      }
+    }
+
+    size_t mismatch;
+    if (!matches(expected, mismatch)) {
+      failures++;
+      if (verbose || failures <= 3) {
+        printf("song %lu deviates from its timeline at event %zu\n", n, mismatch);
+        printSong(song);
+        printEvents("expected", expected, mismatch + 4);
+        printEvents("recorded", recorded, mismatch + 4);
+      }
+    }
+
+    // any bar that starts before the last expected play
+    unsigned long seekPulse = (rng() % (expected[expected.size() - 4].pulse / TIMELINE_PULSES_PR_BAR + 1)) * TIMELINE_PULSES_PR_BAR;
+    if (seekPulse > 0) {
+      seekPulses += simulate(song, seekPulse) - seekPulse;
+      std::vector<SimEvent> seeked = expectedAfterSeek(expected, seekPulse);
+      if (!matches(seeked, mismatch)) {
+        seekFailures++;
+        if (verbose || seekFailures <= 3) {
+          printf("song %lu deviates from its timeline after seeking to pulse %lu at event %zu\n", n, seekPulse, mismatch);
+          printSong(song);
+          printEvents("expected", seeked, mismatch + 4);
+          printEvents("recorded", recorded, mismatch + 4);
+        }
+      }
+    }
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  double songSeconds = totalPulses * 60.0 / (bpm * PPQN) / max(songs, 1UL);
+  printf("songs: %lu | failures: %lu | timeline failures: %lu | seek failures: %lu | pulses: %llu | avg song length at %.0f bpm: %.1f s\n",
+         songs, failures, timelineFailures, seekFailures, totalPulses, bpm, songSeconds);
+  printf("%.0f songs/s | %.1f ns pr pulse\n", songs / seconds, seconds * 1e9 / max(totalPulses + seekPulses, 1ULL));
+  return (failures || timelineFailures || seekFailures) ? 1 : 0;
+}
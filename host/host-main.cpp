@@ -0,0 +1,315 @@
+/*
+* Runs the unmodified song manager sketch as a Linux executable.
+*
+* build (from the repository root):
+*   g++ -std=gnu++17 -O2 -g -fpermissive -w -Ihost host/host-main.cpp -o song-manager-host
+*
+* usage:
+*   ./song-manager-host [--bpm N] [--duration MS] [--eeprom FILE] [--tick US]
+*   ./song-manager-host --bench-parser [ROUNDS]
+*
+* Serial input is read from stdin (piped input is queued before the run
+* starts so results are reproducible), Serial output goes to stdout and a run
+* summary (virtual time, loop timing, i2c traffic) is printed to stderr.
+* --bpm drives the clock input at 24 PPQN (0 disables the clock), --duration
+* is the virtual run time, --eeprom loads/saves the EEPROM image and --tick
+* is the minimum virtual time charged pr loop() pass.
+*
+* --bench-parser doesn't run the sketch: it parses the command lines of a
+* full 8 part song ROUNDS times (default 1000) with SerialSongParser and
+* reports lines/s (wall clock) and the peak heap the parsing took.
+*/
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <EEPROM.h>
+#include <poll.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <time.h>
+#include <new>
+#include "../shared.h"
+
+// prototypes the Arduino builder would generate for the sketch
+void setup();
+void loop();
+void onAnalogPotChangedHandler(int channel, int pot, uint16_t value);
+void onPartCompleted(uint8_t channelNumber, int8_t chainToChannel);
+void onBeforePartCompleted(uint8_t channelNumber, int8_t chainToChannel);
+void onPartStarted(uint8_t channelNumber);
+void onPartStopped(uint8_t channelNumber);
+void onClockPulse();
+void onSongSaved(int index);
+bool saveSong(const Song& song, int index);
+void prefetchSelectedSong();
+void onSongUploaded(int slot, bool import);
+bool canBeginUploadSong();
+void applyCurrentSongToChannel(int index);
+void applyCurrentSongToChannels();
+void updateTimeline();
+bool seekTo(unsigned long pulse);
+bool seekToBar(unsigned long bar);
+void seekToPart(int direction);
+void applySeek();
+
+#include "../song-manager-v1.ino"
+
+// ---------------------------------------------------------------- simulated slaves
+
+// the drum sequencer holds the registers of every part, the others one set
+struct HostSlave {
+  uint8_t address;
+  uint8_t parts[CHANNELS][256];
+  size_t registerSize;
+  size_t partCount;
+  size_t writeOffset; // full writes fill the parts in order
+  size_t readOffset;
+  int partIndex;
+  bool running;
+  uint8_t staged[256];
+  int stagedLength;
+};
+
+HostSlave hostSlaves[3] = {
+  {SLAVE_ADDR_TEMPO, {{0}}, sizeof(TempoRegisters), 1, 0, 0, -1, false, {0}, -1},
+  {SLAVE_ADDR_DRUM_SEQUENCER, {{0}}, sizeof(DrumSequencer), CHANNELS, 0, 0, -1, false, {0}, -1},
+  {SLAVE_ADDR_SAMPLER, {{0}}, sizeof(SamplerRegisters), 1, 0, 0, -1, false, {0}, -1}
+};
+
+HostSlave* findHostSlave(uint8_t address) {
+  for (int i = 0; i < 3; i++) {
+    if (hostSlaves[i].address == address) return &hostSlaves[i];
+  }
+  return nullptr;
+}
+
+void hostSlaveReceive(uint8_t address, const uint8_t* data, size_t length) {
+  HostSlave* slave = findHostSlave(address);
+  if (!slave) return;
+
+  if (length == 5 && memcmp(data, "start", 5) == 0) { slave->running = true; return; }
+  if (length == 4 && memcmp(data, "stop", 4) == 0) { slave->running = false; return; }
+  if (length == 1 && data[0] == COMMIT_STAGED) {
+    if (slave->stagedLength < 0) return;
+    if (slave->address == SLAVE_ADDR_DRUM_SEQUENCER) slave->partIndex = slave->staged[0];
+    else memcpy(slave->parts[0], slave->staged, min((size_t)slave->stagedLength, slave->registerSize));
+    slave->stagedLength = -1;
+    return;
+  }
+  if (length == 1) { slave->partIndex = data[0]; return; }
+  if (length == 6 && memcmp(data, "pos", 3) == 0) { slave->partIndex = data[3]; return; }
+  if (length >= 3 && memcmp(data, "stg", 3) == 0) {
+    slave->stagedLength = (int)(length - 3);
+    memcpy(slave->staged, data + 3, length - 3);
+    return;
+  }
+  if (length >= 5 && memcmp(data, "dlt", 3) == 0) {
+    if (data[3] >= slave->partCount) return;
+    uint8_t* registers = slave->parts[data[3]];
+    size_t offset = data[4];
+    for (size_t i = 5; i < length && offset < slave->registerSize; i++) {
+      registers[offset++] = data[i];
+    }
+    return;
+  }
+  if (length >= 3 && memcmp(data, "set", 3) == 0) {
+    data += 3;
+    length -= 3;
+    slave->writeOffset = 0;
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    slave->parts[slave->writeOffset / slave->registerSize][slave->writeOffset % slave->registerSize] = data[i];
+    slave->writeOffset = (slave->writeOffset + 1) % (slave->registerSize * slave->partCount);
+  }
+}
+
+// reads the registers of the part playing
+size_t hostSlaveRequest(uint8_t address, uint8_t* data, size_t length) {
+  HostSlave* slave = findHostSlave(address);
+  if (!slave) return 0;
+  const uint8_t* registers = slave->parts[(slave->partIndex >= 0 && (size_t)slave->partIndex < slave->partCount) ? slave->partIndex : 0];
+  for (size_t i = 0; i < length; i++) {
+    data[i] = registers[slave->readOffset];
+    slave->readOffset = (slave->readOffset + 1) % slave->registerSize;
+  }
+  return length;
+}
+
+// parts whose valid shadow differs from what the simulated slave holds
+int hostCheckShadow(uint8_t address, int part, const RegisterShadow& shadow) {
+  HostSlave* slave = findHostSlave(address);
+  if (!slave || !shadow.valid) return 0;
+  if (memcmp(slave->parts[part], shadow.data, shadow.size) == 0) return 0;
+  fprintf(stderr, "slave 0x%02X part %d differs from the master's shadow\n", address, part);
+  return 1;
+}
+
+int hostCheckShadows() {
+  int mismatches = hostCheckShadow(SLAVE_ADDR_TEMPO, 0, tempoShadow);
+  mismatches += hostCheckShadow(SLAVE_ADDR_SAMPLER, 0, samplerShadow);
+  for (int part = 0; part < CHANNELS; part++) {
+    mismatches += hostCheckShadow(SLAVE_ADDR_DRUM_SEQUENCER, part, drumShadows[part]);
+  }
+  return mismatches;
+}
+
+// ---------------------------------------------------------------- heap tracking
+
+size_t hostHeapInUse = 0;
+size_t hostHeapPeak = 0;
+unsigned long hostHeapAllocations = 0;
+
+void* operator new(size_t size) {
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  hostHeapInUse += malloc_usable_size(p);
+  if (hostHeapInUse > hostHeapPeak) hostHeapPeak = hostHeapInUse;
+  hostHeapAllocations++;
+  return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept {
+  if (!p) return;
+  hostHeapInUse -= malloc_usable_size(p);
+  free(p);
+}
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+// ---------------------------------------------------------------- parser benchmark
+
+// the lines SongWriter writes for a song with every part, channel and page in use
+int hostBenchSongLines(char lines[][80], int maxLines) {
+  int count = 0;
+  for (int part = 0; part < CHANNELS && count + 28 <= maxLines; part++) {
+    sprintf(lines[count++], "%d=4 %d %d", part, part + 1, part < CHANNELS - 1 ? part + 1 : -1);
+    sprintf(lines[count++], "%d:tempo=%d", part, 100 + part);
+    sprintf(lines[count++], "%d:sampler=%d", part, part * 3);
+    for (int c = 0; c < 5; c++) sprintf(lines[count++], "%d:sampler:%d.mix=%d", part, c, 200 * c + part);
+    for (int c = 0; c < 5; c++) {
+      sprintf(lines[count++], "%d:seq:%d=1000100010001000 0110011001100110 0x%04X 0b101", part, c, 0x1234 * (c + 1));
+      sprintf(lines[count++], "%d:seq:%d.div=6", part, c);
+      sprintf(lines[count++], "%d:seq:%d.ena=%d", part, c, c & 1);
+      sprintf(lines[count++], "%d:seq:%d.last=%d", part, c, 63 - c);
+    }
+  }
+  return count;
+}
+
+int hostBenchParser(unsigned long rounds) {
+  static char lines[CHANNELS * 28][80];
+  int count = hostBenchSongLines(lines, CHANNELS * 28);
+  Song song;
+  SerialSongParser parser(song);
+  SlaveEnum target;
+  unsigned long failed = 0;
+
+  size_t heapBefore = hostHeapInUse;
+  hostHeapPeak = hostHeapInUse;
+  unsigned long allocationsBefore = hostHeapAllocations;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (unsigned long round = 0; round < rounds; round++) {
+    for (int i = 0; i < count; i++) {
+      if (parser.parseCommand(lines[i], target) < 0) failed++;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  unsigned long parsed = rounds * count;
+  printf("parser: %lu lines (%d pr song) in %.1f ms => %.0f lines/s | failed: %lu\n",
+         parsed, count, seconds * 1000.0, parsed / seconds, failed);
+  printf("heap:   peak %zu bytes above the start | %lu allocations (%.1f pr line)\n",
+         hostHeapPeak - heapBefore, hostHeapAllocations - allocationsBefore,
+         (double)(hostHeapAllocations - allocationsBefore) / parsed);
+  return failed ? 1 : 0;
+}
+
+// ---------------------------------------------------------------- runner
+
+bool hostReadStdin(bool& stdinOpen) {
+  if (!stdinOpen) return false;
+  struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+  if (poll(&fd, 1, 0) <= 0) return false;
+  char buffer[256];
+  ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+  if (n <= 0) {
+    stdinOpen = false;
+    return false;
+  }
+  Serial.hostInput(buffer, (size_t)n);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  double bpm = 120;
+  unsigned long durationMs = 10000;
+  unsigned long tickUs = 10;
+  const char* eepromFile = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--bpm") && i + 1 < argc) bpm = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--duration") && i + 1 < argc) durationMs = strtoul(argv[++i], nullptr, 10);
+    else if (!strcmp(argv[i], "--tick") && i + 1 < argc) tickUs = strtoul(argv[++i], nullptr, 10);
+    else if (!strcmp(argv[i], "--eeprom") && i + 1 < argc) eepromFile = argv[++i];
+    else if (!strcmp(argv[i], "--bench-parser"))
+      return hostBenchParser(i + 1 < argc ? strtoul(argv[i + 1], nullptr, 10) : 1000);
+    else {
+      fprintf(stderr, "usage: %s [--bpm N] [--duration MS] [--eeprom FILE] [--tick US] | --bench-parser [ROUNDS]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (eepromFile) EEPROM.hostLoad(eepromFile);
+  for (int i = 0; i < 3; i++) {
+    Wire.hostAttachSlave(hostSlaves[i].address, hostSlaveReceive, hostSlaveRequest);
+  }
+
+  setup();
+
+  if (bpm > 0) {
+    hostStartPulseTrain(CLOCK_IN_PIN, (uint64_t)(60.0e9 / (bpm * PPQN)));
+  }
+
+  // piped input is queued up front so runs are reproducible
+  bool stdinOpen = true;
+  if (!isatty(STDIN_FILENO)) {
+    char buffer[256];
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
+      Serial.hostInput(buffer, (size_t)n);
+    }
+    stdinOpen = false;
+  }
+  unsigned long passes = 0;
+  uint64_t maxPassNs = 0;
+  uint64_t endNs = (uint64_t)durationMs * 1000000ULL;
+
+  while (hostNanos < endNs) {
+    hostReadStdin(stdinOpen);
+    uint64_t start = hostNanos;
+    loop();
+    uint64_t elapsed = hostNanos - start;
+    if (elapsed < tickUs * 1000ULL) {
+      hostAdvanceNanos(tickUs * 1000ULL - elapsed);
+    }
+    if (elapsed > maxPassNs) maxPassNs = elapsed;
+    passes++;
+  }
+  Serial.flush();
+
+  if (eepromFile) EEPROM.hostSave(eepromFile);
+
+  fprintf(stderr, "\n--- host run summary ---\n");
+  fprintf(stderr, "virtual time:  %lu ms\n", millis());
+  fprintf(stderr, "loop passes:   %lu (avg %.1f us, max %.1f us)\n", passes,
+          passes ? (double)hostNanos / passes / 1000.0 : 0.0, maxPassNs / 1000.0);
+  fprintf(stderr, "i2c:           %lu transmissions, %lu requests, %lu bytes written, %lu bytes read, %lu errors\n",
+          Wire.stats.transmissions, Wire.stats.requests, Wire.stats.bytesWritten, Wire.stats.bytesRead, Wire.stats.errors);
+  fprintf(stderr, "eeprom writes: %lu\n", EEPROM.writes);
+  fprintf(stderr, "slave sync:    %d parts differ from the master's shadows\n", hostCheckShadows());
+  return 0;
+}
@@ -0,0 +1,195 @@
+#ifndef I2CScheduler_h
+#define I2CScheduler_h
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "shared.h"
+#include "logger.h"
+
+#define I2C_QUEUE_SIZE (CHANNELS + 4) // a full drum sequencer sync plus a part transition
+#define I2C_RESERVED_SLOTS 4          // never taken by LOW transfers, the clock path always finds room
+#define I2C_MAX_PAYLOAD (sizeof(DrumSequencer) + 3) // largest register block plus a command prefix
+#define I2C_CHUNK_SIZE 32  // i2c has this limitation
+#define I2C_BUDGET_US 1000 // bus time allowed pr run() call
+
+#define I2C_PRIORITY_LOW 0
+#define I2C_PRIORITY_NORMAL 1
+#define I2C_PRIORITY_HIGH 2
+
+#define I2C_QUEUE_FULL 0xFF // completion result of a write that didn't fit the queue
+
+typedef void (*I2CCompleted)(uint8_t address, uint8_t tag, uint8_t result); // slave address, caller tag, endTransmission result
+
+struct I2CTransaction {
+  bool used;
+  uint8_t address;
+  uint8_t priority;
+  uint8_t tag;
+  uint8_t length;
+  uint8_t sent;
+  uint16_t sequence;
+  unsigned long deadline; // 0 => no deadline
+  I2CCompleted onCompleted;
+  uint8_t payload[I2C_MAX_PAYLOAD];
+};
+
+/*
+* Queued i2c writes. Callers enqueue a payload and return immediately; run()
+* is called from loop() after the clock has been handled and sends 32 byte
+* chunks (one transmission each) until its bus time budget is spent.
+* Transactions to the same slave are always sent in the order they were
+* queued, otherwise the highest priority and then the earliest deadline goes
+* first - picked again for every chunk, so a HIGH write to another slave gets
+* ahead of a LOW transfer that has already started.
+*
+* enqueue() never drives the bus: a write that doesn't fit is dropped, counted
+* and completed with I2C_QUEUE_FULL, so callers tracking what the slaves hold
+* (the register shadows) fall back to a full write.
+*/
+class I2CScheduler {
+  private:
+    I2CTransaction _queue[I2C_QUEUE_SIZE];
+    uint16_t _sequence = 0;
+    unsigned long _late = 0;
+    unsigned long _failed = 0;
+    unsigned long _dropped = 0;
+
+    bool isBefore(const I2CTransaction& a, const I2CTransaction& b) {
+      if (a.priority != b.priority) return a.priority > b.priority;
+      if (a.deadline != b.deadline) {
+        if (a.deadline == 0) return false;
+        if (b.deadline == 0) return true;
+        return (long)(a.deadline - b.deadline) < 0;
+      }
+      return (int16_t)(a.sequence - b.sequence) < 0;
+    }
+
+    bool isHeadOfSlave(int index) {
+      for (int i = 0; i < I2C_QUEUE_SIZE; i++) {
+        if (i == index || !_queue[i].used) continue;
+        if (_queue[i].address == _queue[index].address && (int16_t)(_queue[i].sequence - _queue[index].sequence) < 0)
+          return false;
+      }
+      return true;
+    }
+
+    int8_t selectNext() {
+      int8_t next = -1;
+      for (int i = 0; i < I2C_QUEUE_SIZE; i++) {
+        if (!_queue[i].used || !isHeadOfSlave(i)) continue;
+        if (next == -1 || isBefore(_queue[i], _queue[next])) next = i;
+      }
+      return next;
+    }
+
+    void complete(int8_t index, uint8_t result, unsigned long now) {
+      I2CTransaction& t = _queue[index];
+      if (result != 0) {
+        _failed++;
+        LOG_ERROR("Error while sending data to slave %d: %d", t.address, result);
+      }
+      if (t.deadline != 0 && (long)(now - t.deadline) > 0) _late++;
+      t.used = false;
+      if (t.onCompleted) t.onCompleted(t.address, t.tag, result);
+    }
+
+    // sends the next chunk of the transaction that goes first
+    bool sendChunk(unsigned long now) {
+      int8_t next = selectNext();
+      if (next == -1) return false;
+
+      I2CTransaction& t = _queue[next];
+      uint8_t chunkSize = min(I2C_CHUNK_SIZE, t.length - t.sent);
+      Wire.beginTransmission(t.address);
+      Wire.write(&t.payload[t.sent], chunkSize);
+      uint8_t result = Wire.endTransmission();
+      t.sent += chunkSize;
+
+      if (result != 0 || t.sent >= t.length) complete(next, result, now);
+      return true;
+    }
+
+  public:
+    I2CScheduler() {
+      for (int i = 0; i < I2C_QUEUE_SIZE; i++) _queue[i].used = false;
+    }
+
+    // Queue a write, false => invalid or no room (onCompleted gets I2C_QUEUE_FULL)
+    bool enqueue(uint8_t address, const uint8_t* payload, uint8_t length, uint8_t priority = I2C_PRIORITY_NORMAL,
+                 unsigned long deadline = 0, I2CCompleted onCompleted = nullptr, uint8_t tag = 0) {
+      if (length == 0 || length > I2C_MAX_PAYLOAD) {
+        LOG_ERROR("Invalid i2c payload size: %d", length);
+        return false;
+      }
+
+      int8_t slot = -1;
+      if (freeSlots(priority) > 0) {
+        for (int i = 0; i < I2C_QUEUE_SIZE; i++) {
+          if (!_queue[i].used) { slot = i; break; }
+        }
+      }
+      if (slot == -1) {
+        _dropped++;
+        LOG_WARN("i2c queue full, dropped a write to slave %d", address);
+        if (onCompleted) onCompleted(address, tag, I2C_QUEUE_FULL);
+        return false;
+      }
+
+      I2CTransaction& t = _queue[slot];
+      t.used = true;
+      t.address = address;
+      t.priority = priority;
+      t.tag = tag;
+      t.length = length;
+      t.sent = 0;
+      t.sequence = _sequence++;
+      t.deadline = deadline;
+      t.onCompleted = onCompleted;
+      memcpy(t.payload, payload, length);
+      return true;
+    }
+
+    // slots a write of the priority can take right now
+    uint8_t freeSlots(uint8_t priority) {
+      uint8_t free = 0;
+      for (int i = 0; i < I2C_QUEUE_SIZE; i++) {
+        if (!_queue[i].used) free++;
+      }
+      if (priority > I2C_PRIORITY_LOW) return free;
+      return free > I2C_RESERVED_SLOTS ? free - I2C_RESERVED_SLOTS : 0;
+    }
+
+    // Call from loop() between clock ticks
+    void run(unsigned long now) {
+      unsigned long start = micros();
+      while (sendChunk(now)) {
+        if (micros() - start >= I2C_BUDGET_US) break;
+      }
+    }
+
+    // Send everything queued, e.g. before reading back from a slave
+    void flush() {
+      while (sendChunk(millis()));
+    }
+
+    bool isIdle() {
+      for (int i = 0; i < I2C_QUEUE_SIZE; i++) {
+        if (_queue[i].used) return false;
+      }
+      return true;
+    }
+
+    void printStats() {
+      char s[100];
+      uint8_t queued = 0;
+      for (int i = 0; i < I2C_QUEUE_SIZE; i++) {
+        if (_queue[i].used) queued++;
+      }
+      sprintf_P(s, PSTR("i2c => queued: %d | failed: %lu | missed deadline: %lu | dropped: %lu"), queued, _failed, _late, _dropped);
+      Serial.println(s);
+    }
+};
+
+I2CScheduler i2cScheduler;
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef InputScanner165_h
+#define InputScanner165_h
+
+#include <Arduino.h>
+#include <SPI.h>
+#include "shared.h"
+
+#define INPUT_CHAIN_BYTES (1 + (CHANNELS + 7) / 8) // ops board + 1 pr 8 channel boards
+#define INPUT_SPI_CLOCK 4000000
+
+//#define INPUT_SPI // 165 chain rewired to MISO/SCK - until then it is shifted in on INPUT_DATA/INPUT_CLK
+
+/*
+* Reads the whole 74HC165 chain in one go: a parallel load pulse, then
+* every register shifted in with the clock inhibit pin low. The bytes are
+* kept in chain order (ops board first) for the DebounceButton165 instances.
+* The chain is wired to INPUT_DATA/INPUT_CLK today and is shifted in
+* through the port registers.
+*
+* With INPUT_SPI it is one SPI transfer pr register: mode 2 samples on the
+* falling edge and the 165 shifts on the rising edge, bits arrive LSB first
+* like read165byte() read them. The clock must be high before the inhibit
+* goes low - a rising edge while enabled shifts the chain - so the
+* transaction (which idles SCK high in mode 2) is begun first. The display
+* shares SCK - harmless, the 165s ignore it while inhibited and the 595s
+* only show what is latched. QH can't be tri-stated, so MISO is the 165's.
+* The transfer runs with interrupts off so the display refresh can't cut in.
+*/
+class InputScanner165 {
+  private:
+    uint8_t _loadPin;
+    uint8_t _inhibitPin;
+    uint8_t _clockPin;
+    uint8_t _dataPin;
+    uint8_t _bytes[INPUT_CHAIN_BYTES];
+
+#ifdef __AVR__
+    // digitalWrite/digitalRead look the pin up on every call
+    volatile uint8_t* _loadPort;
+    uint8_t _loadMask;
+#ifndef INPUT_SPI
+    volatile uint8_t* _clockPort;
+    uint8_t _clockMask;
+    volatile uint8_t* _dataPort;
+    uint8_t _dataMask;
+#endif
+#endif
+
+    void setLoad(bool high) {
+#ifdef __AVR__
+      if(high) *_loadPort |= _loadMask;
+      else *_loadPort &= ~_loadMask;
+#else
+      digitalWrite(_loadPin, high);
+#endif
+    }
+
+#ifndef INPUT_SPI
+    uint8_t shiftInByte() {
+      uint8_t value = 0;
+      for(int i=0; i<8; i++) {
+#ifdef __AVR__
+        *_clockPort &= ~_clockMask;
+        if(*_dataPort & _dataMask) value |= (1 << i);
+        *_clockPort |= _clockMask;
+#else
+        digitalWrite(_clockPin, LOW);
+        if(digitalRead(_dataPin)) value |= (1 << i);
+        digitalWrite(_clockPin, HIGH);
+#endif
+      }
+      return value;
+    }
+#endif
+
+  public:
+    InputScanner165(uint8_t loadPin, uint8_t inhibitPin, uint8_t clockPin, uint8_t dataPin)
+      : _loadPin(loadPin), _inhibitPin(inhibitPin), _clockPin(clockPin), _dataPin(dataPin) {
+      memset(_bytes, 0xFF, sizeof(_bytes));
+    }
+
+    void Begin() {
+      pinMode(_loadPin, OUTPUT);
+      pinMode(_inhibitPin, OUTPUT);
+      digitalWrite(_loadPin, HIGH);
+      digitalWrite(_inhibitPin, HIGH);
+#ifndef INPUT_SPI
+      pinMode(_clockPin, OUTPUT);
+      pinMode(_dataPin, INPUT);
+      digitalWrite(_clockPin, HIGH);
+#else
+      SPI.begin();
+#endif
+
+#ifdef __AVR__
+      _loadPort = portOutputRegister(digitalPinToPort(_loadPin));
+      _loadMask = digitalPinToBitMask(_loadPin);
+#ifndef INPUT_SPI
+      _clockPort = portOutputRegister(digitalPinToPort(_clockPin));
+      _clockMask = digitalPinToBitMask(_clockPin);
+      _dataPort = portInputRegister(digitalPinToPort(_dataPin));
+      _dataMask = digitalPinToBitMask(_dataPin);
+#endif
+#endif
+    }
+
+    void Scan() {
+      setLoad(false); // the 165 needs ~20 ns, a port write takes longer
+      setLoad(true);
+
+#ifndef INPUT_SPI
+      digitalWrite(_inhibitPin, LOW); // the clock idles high
+      for(int i=0; i<INPUT_CHAIN_BYTES; i++)
+        _bytes[i] = shiftInByte();
+      digitalWrite(_inhibitPin, HIGH);
+#else
+      noInterrupts();
+      SPI.beginTransaction(SPISettings(INPUT_SPI_CLOCK, LSBFIRST, SPI_MODE2)); // SCK goes high
+      digitalWrite(_inhibitPin, LOW);
+      for(int i=0; i<INPUT_CHAIN_BYTES; i++)
+        _bytes[i] = SPI.transfer(0);
+      digitalWrite(_inhibitPin, HIGH);
+      SPI.endTransaction();
+      interrupts();
+#endif
+    }
+
+    // 0 => ops board, 1.. => channel boards - 0xFF when the board isn't connected
+    uint8_t Byte(uint8_t index) {
+      return _bytes[index];
+    }
+};
+
+#endif
@@ -11,11 +11,11 @@
 
 struct TestContext {
   int index;
-  Part part;
+  const Part& part;
 };
 
 bool SamplerTest_GetDataFromSlave(TestContext context) {
-  Serial.print("Running test SamplerTest_GetDataFromSlave:");  
+  Serial.print(F("Running test SamplerTest_GetDataFromSlave:"));  
   // arrange
   SamplerRegisters samplerRegisters;
 
@@ -24,12 +24,12 @@ bool SamplerTest_GetDataFromSlave(TestContext context) {
 
   // assert
   if(Wire.available() == 0) {
-    Serial.println("Error while retrieving status from slave");
+    Serial.println(F("Error while retrieving status from slave"));
     return false;
   }
   if(Wire.available() != sizeof(SamplerRegisters)) {
     char s[100];
-    sprintf(s, "Error data size from slave - expected: %d, actual: %d", sizeof(SamplerRegisters), Wire.available());
+    sprintf_P(s, PSTR("Error data size from slave - expected: %u, actual: %d"), (unsigned)sizeof(SamplerRegisters), Wire.available());
     Serial.println(s);
     return false;
   }
@@ -41,7 +41,7 @@ bool SamplerTest_GetDataFromSlave(TestContext context) {
 }
 
 bool SamplerTest_SetDataFromMaster(TestContext context) {
-  Serial.println("Running test SamplerTest_SetDataFromMaster:");
+  Serial.println(F("Running test SamplerTest_SetDataFromMaster:"));
 
   // arrange
   SamplerRegisters samplerRegisters;
@@ -62,7 +62,7 @@ bool SamplerTest_SetDataFromMaster(TestContext context) {
   Wire.write(&buffer[0], totalSize);
   int result = Wire.endTransmission(); 
   if(result != 0) {
-    Serial.println("Error while sending data to slave");
+    Serial.println(F("Error while sending data to slave"));
     return false;    
   }
 
@@ -72,7 +72,7 @@ bool SamplerTest_SetDataFromMaster(TestContext context) {
 }
 
 bool TempoTest_GetDataFromSlave(TestContext context) {
-  Serial.print("Running test TempoTest_GetDataFromSlave:");  
+  Serial.print(F("Running test TempoTest_GetDataFromSlave:"));  
   // arrange
   TempoRegisters tempoRegisters;
 
@@ -81,12 +81,12 @@ bool TempoTest_GetDataFromSlave(TestContext context) {
 
   // assert
   if(Wire.available() == 0) {
-    Serial.println("Error while retrieving status from slave");
+    Serial.println(F("Error while retrieving status from slave"));
     return false;
   }
   if(Wire.available() != sizeof(TempoRegisters)) {
     char s[100];
-    sprintf(s, "Error data size from slave - expected: %d, actual: %d", sizeof(TempoRegisters), Wire.available());
+    sprintf_P(s, PSTR("Error data size from slave - expected: %u, actual: %d"), (unsigned)sizeof(TempoRegisters), Wire.available());
     Serial.println(s);
     return false;
   }
@@ -98,7 +98,7 @@ bool TempoTest_GetDataFromSlave(TestContext context) {
 }
 
 bool TempoTest_SetDataFromMaster(TestContext context, char* command) {
-  Serial.println("Running test TempoTest_SetDataFromMaster:");
+  Serial.println(F("Running test TempoTest_SetDataFromMaster:"));
 
   // arrange
   TempoRegisters tempoRegisters;
@@ -119,7 +119,7 @@ bool TempoTest_SetDataFromMaster(TestContext context, char* command) {
   Wire.write(&buffer[0], totalSize);
   int result = Wire.endTransmission(); 
   if(result != 0) {
-    Serial.println("Error while sending data to slave");
+    Serial.println(F("Error while sending data to slave"));
     return false;    
   }
 
@@ -129,7 +129,7 @@ bool TempoTest_SetDataFromMaster(TestContext context, char* command) {
 }
 
 bool SequencerTest_GetDataFromSlave(TestContext context) {
-  Serial.println("Running test SequencerTest_GetDataFromSlave:");  
+  Serial.println(F("Running test SequencerTest_GetDataFromSlave:"));  
 
   // arrange
   DrumSequencer registers;
@@ -151,11 +151,11 @@ bool SequencerTest_GetDataFromSlave(TestContext context) {
     }
 
     char s[100];
-    sprintf(s, "Reading %d/%d => ", i, totalChunks);
+    sprintf_P(s, PSTR("Reading %d/%d => "), i, totalChunks);
     Serial.print(s);
     for(int j=0; j<bytesRead; j++) {
       Serial.print(buffer[j], HEX);
-      Serial.print(" ");
+      Serial.print(F(" "));
     }
     Serial.println();
 
@@ -169,7 +169,7 @@ bool SequencerTest_GetDataFromSlave(TestContext context) {
 }
 
 bool SequencerTest_SetDataFromMaster(TestContext context) {
-  Serial.println("Running test SequencerTest_SetDataFromMaster:");
+  Serial.println(F("Running test SequencerTest_SetDataFromMaster:"));
 
   // arrange
   bool ena[5] = {true, true, false, false, false};
@@ -205,7 +205,7 @@ bool SequencerTest_SetDataFromMaster(TestContext context) {
       Wire.write(&buffer[offset], chunkSize);
       int result = Wire.endTransmission(); 
       if(result != 0) {
-        Serial.println("Error while sending data to slave");
+        Serial.println(F("Error while sending data to slave"));
         return false;    
       }
       chunkIndex++;    
@@ -217,7 +217,7 @@ bool SequencerTest_SetDataFromMaster(TestContext context) {
 }
 
 bool SequencerTest_SetPartIndexFromMaster(TestContext context) {
-  Serial.println("Running test SequencerTest_SetPartIndexFromMaster:");
+  Serial.println(F("Running test SequencerTest_SetPartIndexFromMaster:"));
 
   // arrange
   int partIndex = context.index;
@@ -227,7 +227,7 @@ bool SequencerTest_SetPartIndexFromMaster(TestContext context) {
   Wire.write(partIndex);
   int result = Wire.endTransmission(); 
   if(result != 0) {
-    Serial.print("Error while sending part-index to drum sequencer: ");
+    Serial.print(F("Error while sending part-index to drum sequencer: "));
     Serial.println(result);
     return false;    
   }
@@ -235,19 +235,17 @@ bool SequencerTest_SetPartIndexFromMaster(TestContext context) {
   return true;
 }
 
-void runIntegrationTest(int testIndex, int channel, Song song) {
+void runIntegrationTest(int testIndex, int channel, const Song& song) {
   char s[100];
-  sprintf(s, "testIndex: %d  |  channel: %d", testIndex, channel);
+  sprintf_P(s, PSTR("testIndex: %d  |  channel: %d"), testIndex, channel);
   Serial.println(s);
   
   if (channel < 0 || channel >= CHANNELS) {
-      Serial.println("Invalid channel");
+      Serial.println(F("Invalid channel"));
       return;
   }
 
-  Part part = song.parts[channel];
-
-  TestContext context = {channel, part};
+  TestContext context = {channel, song.parts[channel]};
   bool result = true;
 
   switch(testIndex) {
@@ -275,9 +273,9 @@ void runIntegrationTest(int testIndex, int channel, Song song) {
   
 
   if(result)
-    Serial.println("INTEGRATION TEST PASSED SUCCESSFULLY");
+    Serial.println(F("INTEGRATION TEST PASSED SUCCESSFULLY"));
   else
-    Serial.println("INTEGRATION TEST COMPLETED WITH ERRORS!!!");  
+    Serial.println(F("INTEGRATION TEST COMPLETED WITH ERRORS!!!"));  
 }
 
 
@@ -3,6 +3,9 @@
 
 #include <Wire.h>
 #include "shared.h"
+#include "i2c-scheduler.h"
+#include "delta-sync.h"
+#include "logger.h"
 
 #define SLAVE_ADDR_TEMPO 8
 #define SLAVE_ADDR_DRUM_SEQUENCER 9
@@ -13,6 +16,7 @@
 
 #define MAX_CHUNK_SIZE 32 // i2c has this limitation
 
+#define PART_CHANGE_DEADLINE 10 // ms - registers for the next part must be on the slaves before the part boundary
 
 
 
@@ -23,22 +27,23 @@ KosmoSlave slaves[numberOfSlaves] = {
   {SLAVE_ADDR_SAMPLER, false, false, 0,0, sizeof(SamplerRegisters)}
 };
 
+void invalidateSlaveShadows();
+
 void setupMaster() {
   Wire.begin();
   Wire.setClock(400000);
+  invalidateSlaveShadows();
 }
 
 bool getKosmoTempoRegisters(unsigned long now, int slaveIndex) {
   Wire.requestFrom(slaves[slaveIndex].address, slaves[slaveIndex].registerSize);
 
   if(Wire.available() == 0) {
-    Serial.println("Error while retrieving status from slave");
+    LOG_ERROR("Error while retrieving status from slave %d", slaveIndex);
     return false;
   }
   if(Wire.available() != slaves[slaveIndex].registerSize) {
-    char s[100];
-    sprintf(s, "Error data size from slave - expected: %d, actual: %d", slaves[slaveIndex].registerSize, Wire.available());
-    Serial.println(s);
+    LOG_ERROR("Error data size from slave - expected: %d, actual: %d", slaves[slaveIndex].registerSize, Wire.available());
     return false;
   }
   Wire.readBytes((char*)&sharedTempoRegisters, slaves[slaveIndex].registerSize);
@@ -74,13 +79,11 @@ bool getKosmoSampleRegisters(unsigned long now, int slaveIndex) {
   Wire.requestFrom(slaves[slaveIndex].address, slaves[slaveIndex].registerSize);
 
   if(Wire.available() == 0) {
-    Serial.println("Error while retrieving status from slave");
+    LOG_ERROR("Error while retrieving status from slave %d", slaveIndex);
     return false;
   }
   if(Wire.available() != slaves[slaveIndex].registerSize) {
-    char s[100];
-    sprintf(s, "Error data size from slave - expected: %d, actual: %d", slaves[slaveIndex].registerSize, Wire.available());
-    Serial.println(s);
+    LOG_ERROR("Error data size from slave - expected: %d, actual: %d", slaves[slaveIndex].registerSize, Wire.available());
     return false;
   }
   Wire.readBytes((char*)&sharedSamplerRegisters, sizeof(SamplerRegisters));  
@@ -90,12 +93,13 @@ bool getKosmoSampleRegisters(unsigned long now, int slaveIndex) {
 bool getSlaveRegisters(unsigned long now, bool &success) {
   // Check if we are in programming mode and if a request is in progress
   success = false;
+  i2cScheduler.flush(); // reads must see everything we have written
+
   bool results[numberOfSlaves] = {false};
   for(int i=0; i<numberOfSlaves; i++) {
 
     if(!slaves[i].requestInProgress && now > (slaves[i].lastGetRequest + RETRY_INTERVAL)) {
-      Serial.print("Starting get request to slave ");
-      Serial.println(i);
+      LOG_DEBUG("Starting get request to slave %d", i);
       slaves[i].requestInProgress = true;
       slaves[i].lastGetRequest = now;
 
@@ -114,9 +118,7 @@ bool getSlaveRegisters(unsigned long now, bool &success) {
         success = true;
       } else if(slaves[i].retries < RETRY_LIMIT) {
         slaves[i].retries++;
-        Serial.print("No registers received from slave ");
-        Serial.print(i);
-        Serial.println(". Retrying in 1s");
+        LOG_WARN("No registers received from slave %d. Retrying in 1s", i);
       } else {
         // unable to get data from slave within the retry limit
         results[i] = true;
@@ -133,128 +135,202 @@ bool getSlaveRegisters(unsigned long now, bool &success) {
   return true;
 }
 
-void setKosmoTempoRegisters(unsigned long now, int slaveIndex, TempoRegisters regs) {
-  const size_t totalSize = slaves[slaveIndex].registerSize;
-  uint8_t buffer[totalSize];
-  memcpy(buffer, &regs, totalSize); 
-
-  Wire.beginTransmission(slaves[slaveIndex].address);
-  Wire.write("set");
-  Wire.write(&buffer[0], totalSize);
-  int result = Wire.endTransmission(); 
-  if(result != 0) {
-    Serial.print("Error while sending data to clock");
-    Serial.println(result);
-    return false;    
+// writes are queued on the i2c scheduler and sent from loop() between clock ticks
+
+// what each slave holds according to the transmissions it acknowledged
+#define SHADOW_TAG_TEMPO 0x80
+#define SHADOW_TAG_SAMPLER 0x81
+
+uint8_t tempoShadowData[sizeof(TempoRegisters)];
+uint8_t samplerShadowData[sizeof(SamplerRegisters)];
+uint8_t drumShadowData[CHANNELS][sizeof(DrumSequencer)];
+RegisterShadow tempoShadow = {tempoShadowData, sizeof(TempoRegisters), false};
+RegisterShadow samplerShadow = {samplerShadowData, sizeof(SamplerRegisters), false};
+RegisterShadow drumShadows[CHANNELS];
+
+void invalidateSlaveShadows() {
+  tempoShadow.valid = false;
+  samplerShadow.valid = false;
+  for(int i=0; i<CHANNELS; i++) {
+    drumShadows[i] = {drumShadowData[i], sizeof(DrumSequencer), false};
   }
-  return true;
 }
 
-bool sendPartIndex(unsigned long now, int partIndex) {
-  Wire.beginTransmission(SLAVE_ADDR_DRUM_SEQUENCER);
-  Wire.write(partIndex);
-  int result = Wire.endTransmission(); 
-  if(result != 0) {
-    Serial.print("Error while sending part-index to drum sequencer: ");
-    Serial.println(result);
-    return false;    
-  }  
-  return true;
+void onShadowedWriteCompleted(uint8_t, uint8_t tag, uint8_t result) {
+  if(result == 0) return;
+  // the slave may hold anything now - next sync is a full write
+  if(tag == SHADOW_TAG_TEMPO) tempoShadow.valid = false;
+  else if(tag == SHADOW_TAG_SAMPLER) samplerShadow.valid = false;
+  else if(tag < CHANNELS) drumShadows[tag].valid = false;
 }
 
+bool setKosmoTempoRegisters(unsigned long now, int slaveIndex, const TempoRegisters& regs, uint8_t priority = I2C_PRIORITY_NORMAL, unsigned long deadline = 0) {
+  const size_t totalSize = slaves[slaveIndex].registerSize;
+  if(tempoShadow.valid) {
+    queueDelta(slaves[slaveIndex].address, 0, (const uint8_t*)&regs, tempoShadow, priority, deadline, onShadowedWriteCompleted, SHADOW_TAG_TEMPO);
+    return true;
+  }
+  uint8_t buffer[totalSize + 3];
+  memcpy(buffer, "set", 3);
+  memcpy(&buffer[3], &regs, totalSize); 
+  acceptFull((const uint8_t*)&regs, tempoShadow);
+  return i2cScheduler.enqueue(slaves[slaveIndex].address, buffer, totalSize + 3, priority, deadline, onShadowedWriteCompleted, SHADOW_TAG_TEMPO);
+}
 
+bool sendPartIndex(unsigned long now, int partIndex, uint8_t priority = I2C_PRIORITY_HIGH, unsigned long deadline = 0) {
+  uint8_t data = partIndex;
+  return i2cScheduler.enqueue(SLAVE_ADDR_DRUM_SEQUENCER, &data, 1, priority, deadline);
+}
 
-bool setKosmoDrumSequencerRegisters(unsigned long now, int slaveIndex, DrumSequencer drums) {
-  size_t totalSize = slaves[slaveIndex].registerSize;
-  int totalChunks = (totalSize + 31) / 32;
-  int chunkIndex = 0;
+// "pos" | part index | step (2 bytes): the drum sequencer continues the part from the step on its next downbeat
+bool sendPartPosition(unsigned long now, int partIndex, uint16_t step, uint8_t priority = I2C_PRIORITY_HIGH) {
+  uint8_t buffer[6];
+  memcpy(buffer, "pos", 3);
+  buffer[3] = partIndex;
+  memcpy(&buffer[4], &step, 2);
+  return i2cScheduler.enqueue(SLAVE_ADDR_DRUM_SEQUENCER, buffer, 6, priority);
+}
 
-  uint8_t buffer[totalSize];
-  memcpy(buffer, &drums, totalSize);  
+bool setKosmoDrumSequencerRegisters(unsigned long now, int slaveIndex, const DrumSequencer& drums, I2CCompleted onCompleted = nullptr, uint8_t tag = 0) {
+  // the slave reassembles the registers from consecutive 32 byte chunks
+  return i2cScheduler.enqueue(slaves[slaveIndex].address, (const uint8_t*)&drums, slaves[slaveIndex].registerSize, I2C_PRIORITY_LOW, 0, onCompleted, tag);
+}
 
-  for(int i=0; i<totalChunks; i++) {
-    size_t offset = chunkIndex * 32;
-    size_t chunkSize = min(32, totalSize - offset);
-    Wire.beginTransmission(slaves[slaveIndex].address);
-    Wire.write(&buffer[offset], chunkSize);
-    int result = Wire.endTransmission(); 
-    if(result != 0) {
-      Serial.print("Error while sending data to drum sequencer");
-      Serial.println(result);
-      return false;    
-    }
-    chunkIndex++;    
+// set when the parts couldn't be queued, loop() sends them once the queue has room
+bool drumPartsPending = false;
+
+bool sendAllDrumSequencerParts(unsigned long now, const Song& song) {
+  bool allShadowed = true;
+  for(int part=0; part<CHANNELS; part++) {
+    allShadowed &= drumShadows[part].valid;
   }
 
-  return true;
-}
+  // full writes are positional, a part missing from the queue would shift the ones after it
+  if(!allShadowed && i2cScheduler.freeSlots(I2C_PRIORITY_LOW) < CHANNELS) {
+    drumPartsPending = true;
+    return false;
+  }
+  drumPartsPending = false;
 
-bool sendAllDrumSequencerParts(unsigned long now, Song song) {
   bool result = true;
+  DrumSequencer drums;
   for(int part=0; part<CHANNELS; part++) {
-    result &= setKosmoDrumSequencerRegisters(now, 1, song.parts[part].drumSequencer);
+    toDrumSequencerRegisters(song.parts[part].drumSequencer, drums);
+    const uint8_t* regs = (const uint8_t*)&drums;
+    if(allShadowed) {
+      queueDelta(slaves[1].address, part, regs, drumShadows[part], I2C_PRIORITY_LOW, 0, onShadowedWriteCompleted, part);
+      if(!drumShadows[part].valid) {
+        // a range didn't fit the queue, the parts go out in full once there is room
+        drumPartsPending = true;
+        result = false;
+      }
+    } else {
+      // full writes are positional, so all parts go out in order
+      acceptFull(regs, drumShadows[part]);
+      result &= setKosmoDrumSequencerRegisters(now, 1, drums, onShadowedWriteCompleted, part);
+    }
   }
+  return result;
 }
 
-bool setSamplerRegisters(unsigned long now, int slaveIndex, SamplerRegisters sampler) {
+bool setSamplerRegisters(unsigned long now, int slaveIndex, const SamplerRegisters& sampler, uint8_t priority = I2C_PRIORITY_NORMAL, unsigned long deadline = 0) {
   return true;
-  const size_t totalSize = slaves[slaveIndex].registerSize;
-  uint8_t buffer[totalSize];
-  memcpy(buffer, &sampler, totalSize); 
-
-  Wire.beginTransmission(slaves[slaveIndex].address);
-  Wire.write(&buffer[0], totalSize);
-  int result = Wire.endTransmission(); 
-  if(result != 0) {
-    Serial.print("Error while sending data to sampler: ");
-    Serial.println(result);
-    return false;    
+  if(samplerShadow.valid) {
+    queueDelta(slaves[slaveIndex].address, 0, (const uint8_t*)&sampler, samplerShadow, priority, deadline, onShadowedWriteCompleted, SHADOW_TAG_SAMPLER);
+    return true;
   }
-  return true;
+  acceptFull((const uint8_t*)&sampler, samplerShadow);
+  return i2cScheduler.enqueue(slaves[slaveIndex].address, (const uint8_t*)&sampler, slaves[slaveIndex].registerSize, priority, deadline, onShadowedWriteCompleted, SHADOW_TAG_SAMPLER);
 }
 
-void setSlaveRegister(unsigned long now, Part part, SlaveEnum slave) {
-  int index = (int)slave;
-
-  // Serial.print("Starting SET request to slave ");
-  // Serial.println(index);
-  slaves[index].requestInProgress = true;
-
+void setSlaveRegister(unsigned long now, const Part& part, SlaveEnum slave, uint8_t priority = I2C_PRIORITY_NORMAL, unsigned long deadline = 0) {
   if(slave == TEMPO)
-    setKosmoTempoRegisters(now, (int)slave, part.tempo);
-  else if(slave == DRUM_SEQUENCER)
-    setKosmoDrumSequencerRegisters(now, (int)slave, part.drumSequencer);
+    setKosmoTempoRegisters(now, (int)slave, part.tempo, priority, deadline);
+  else if(slave == DRUM_SEQUENCER) {
+    // lands in whatever part slot the slave is filling, so the drum shadows can't be trusted afterwards
+    for(int i=0; i<CHANNELS; i++) drumShadows[i].valid = false;
+    DrumSequencer drums;
+    toDrumSequencerRegisters(part.drumSequencer, drums);
+    setKosmoDrumSequencerRegisters(now, (int)slave, drums);
+  }
   else if(slave == SAMPLER)
-    setSamplerRegisters(now, (int)slave, part.sampler);
-
-  slaves[index].requestInProgress = false;
+    setSamplerRegisters(now, (int)slave, part.sampler, priority, deadline);
 }
 
-void setSlaveRegisters(unsigned long now, Part part, SlaveEnum slave = ALL) {
+void setSlaveRegisters(unsigned long now, const Part& part, SlaveEnum slave = ALL, uint8_t priority = I2C_PRIORITY_NORMAL, unsigned long deadline = 0) {
   if(slave == ALL) {
     for(int i=0; i<numberOfSlaves; i++) {
       if(i != 1) { // skip drum sequencer
-        setSlaveRegister(now, part, (SlaveEnum)i);
+        setSlaveRegister(now, part, (SlaveEnum)i, priority, deadline);
       }
     }
   } else {
-    setSlaveRegister(now, part, slave);
+    setSlaveRegister(now, part, slave, priority, deadline);
   }
 }
 
+/*
+* Staged part transitions: as soon as the next part is known its registers
+* go to an inactive bank on each slave ("stg" | registers, the drum
+* sequencer gets "stg" | part index since it already holds all parts).
+* At the part boundary a single COMMIT_STAGED byte pr slave swaps the banks.
+*/
+#define COMMIT_STAGED 0xC0
+#define SHADOW_TAG_STAGE 0x90
+
+int8_t stagedPart = -1;
+TempoRegisters stagedTempo;
+SamplerRegisters stagedSampler;
+
+void onStageCompleted(uint8_t, uint8_t, uint8_t result) {
+  if(result != 0) stagedPart = -1; // fall back to a full transfer at the boundary
+}
+
+void invalidateStagedPart() {
+  stagedPart = -1;
+}
+
+bool stagePart(unsigned long now, int8_t partIndex, const Part& part) {
+  if(partIndex < 0 || partIndex >= CHANNELS) return false;
+  if(partIndex == stagedPart) return true;
+
+  uint8_t buffer[I2C_CHUNK_SIZE];
+  memcpy(buffer, "stg", 3);
+
+  memcpy(&buffer[3], &part.tempo, sizeof(TempoRegisters));
+  i2cScheduler.enqueue(slaves[TEMPO].address, buffer, sizeof(TempoRegisters) + 3, I2C_PRIORITY_NORMAL, 0, onStageCompleted, SHADOW_TAG_STAGE);
+
+  buffer[3] = partIndex;
+  i2cScheduler.enqueue(slaves[DRUM_SEQUENCER].address, buffer, 4, I2C_PRIORITY_NORMAL, 0, onStageCompleted, SHADOW_TAG_STAGE);
+
+  // sampler writes are disabled, see setSamplerRegisters
+
+  stagedTempo = part.tempo;
+  stagedSampler = part.sampler;
+  stagedPart = partIndex;
+  return true;
+}
+
+bool commitStagedPart(unsigned long now, int8_t partIndex, unsigned long deadline) {
+  if(stagedPart == -1 || partIndex != stagedPart) return false;
+
+  uint8_t commit = COMMIT_STAGED;
+  i2cScheduler.enqueue(slaves[TEMPO].address, &commit, 1, I2C_PRIORITY_HIGH, deadline, onShadowedWriteCompleted, SHADOW_TAG_TEMPO);
+  i2cScheduler.enqueue(slaves[DRUM_SEQUENCER].address, &commit, 1, I2C_PRIORITY_HIGH, deadline);
+
+  // the staged bank is now the active one
+  memcpy(tempoShadow.data, &stagedTempo, sizeof(TempoRegisters));
+  tempoShadow.valid = true;
+  memcpy(samplerShadow.data, &stagedSampler, sizeof(SamplerRegisters));
+  stagedPart = -1;
+  return true;
+}
+
 void startClock() {
-  slaves[0].requestInProgress = true;  
-  Wire.beginTransmission(slaves[0].address);
-  Wire.write("start"); 
-  int result = Wire.endTransmission(); 
-  slaves[0].requestInProgress = false;    
+  i2cScheduler.enqueue(slaves[0].address, (const uint8_t*)"start", 5, I2C_PRIORITY_HIGH);
 }
 
 void stopClock() {
-  slaves[0].requestInProgress = true;  
-  Wire.beginTransmission(slaves[0].address);
-  Wire.write("stop"); 
-  int result = Wire.endTransmission(); 
-  slaves[0].requestInProgress = false;     
+  i2cScheduler.enqueue(slaves[0].address, (const uint8_t*)"stop", 4, I2C_PRIORITY_HIGH);
 }
 #endif
\ No newline at end of file
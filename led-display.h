@@ -0,0 +1,196 @@
+#ifndef LedDisplay_h
+#define LedDisplay_h
+
+#include <Arduino.h>
+#include <SPI.h>
+#include "shared.h"
+
+#define DISPLAY_DIGITS 5
+#define DISPLAY_BYTES_PR_DIGIT (2 + 2 * CHANNELS) // ops board + 2 pr channel board
+#define DISPLAY_DIGIT_US 2000 // one digit pr 2 ms => the whole display at 100 Hz
+#define DISPLAY_SPI_CLOCK 8000000
+
+//#define DISPLAY_SPI // 595 chain rewired to MOSI/SCK - until then it is shifted out on LED_DATA/LED_CLOCK
+
+#ifdef DISPLAY_SPI
+#define DISPLAY_SLICES 1 // refreshes pr digit
+#else
+#define DISPLAY_SLICES 2 // half a digit pr interrupt keeps it short
+#endif
+#define DISPLAY_SLICE_BYTES (DISPLAY_BYTES_PR_DIGIT / DISPLAY_SLICES)
+#define DISPLAY_REFRESH_US (DISPLAY_DIGIT_US / DISPLAY_SLICES)
+
+static_assert(DISPLAY_BYTES_PR_DIGIT % DISPLAY_SLICES == 0, "a digit must split into whole slices");
+
+/*
+* Multiplexed 74HC595 display refresh
+*
+* The loop builds a whole frame - every byte of every digit - into the back
+* buffer and Swap()s it in, only when what is displayed has changed. The
+* refresh flips the buffers before the first slice of a digit, so a digit is
+* never shifted half from one frame and half from the next; until then the
+* swap is pending and the loop must not build the next frame.
+* Refresh() shifts a digit row out and latches it: from the timer 3 compare
+* interrupt on the Mega, so every digit is lit for the same time no matter
+* how long a loop pass takes, and from Run() on the host.
+*
+* Rows are shifted MSB first with the latch on its own pin. Ops board bytes
+* are wired LSB first, use Reverse(). The chain is wired to LED_DATA and
+* LED_CLOCK today, so the bits are banged through the port registers - a
+* digit takes ~90 us that way, so it is shifted in two halves, one pr
+* interrupt, and the other interrupts (serial, clock in) wait 45 us at
+* most. With DISPLAY_SPI (MOSI 51, SCK 52) a whole digit takes ~20 us.
+*/
+class LedDisplay {
+  private:
+    uint8_t _frames[2][DISPLAY_DIGITS][DISPLAY_BYTES_PR_DIGIT];
+    volatile uint8_t _front = 0;
+    volatile bool _swapPending = false;
+    volatile uint8_t _digit = 0;
+    uint8_t _latchPin;
+    uint8_t _dataPin;
+    uint8_t _clockPin;
+    uint8_t _slice = 0;
+    unsigned long _nextRefresh = 0;
+    volatile unsigned long _refreshes = 0;
+    unsigned long _swaps = 0;
+
+#if defined(__AVR__) && !defined(DISPLAY_SPI)
+    // digitalWrite looks the pin up on every call
+    volatile uint8_t* _latchPort;
+    uint8_t _latchMask;
+    volatile uint8_t* _dataPort;
+    uint8_t _dataMask;
+    volatile uint8_t* _clockPort;
+    uint8_t _clockMask;
+#endif
+
+    void setLatch(bool high) {
+#if defined(__AVR__) && !defined(DISPLAY_SPI)
+      if(high) *_latchPort |= _latchMask;
+      else *_latchPort &= ~_latchMask;
+#else
+      digitalWrite(_latchPin, high);
+#endif
+    }
+
+    void shiftOutBytes(const uint8_t* bytes, uint8_t count) {
+#ifdef DISPLAY_SPI
+      SPI.beginTransaction(SPISettings(DISPLAY_SPI_CLOCK, MSBFIRST, SPI_MODE0));
+      for(uint8_t i=0; i<count; i++)
+        SPI.transfer(bytes[i]);
+      SPI.endTransaction();
+#elif defined(__AVR__)
+      // only called with interrupts off, nothing else can touch the ports meanwhile
+      uint8_t dataLow = *_dataPort & ~_dataMask;
+      uint8_t dataHigh = dataLow | _dataMask;
+      uint8_t clockLow = *_clockPort & ~_clockMask;
+      uint8_t clockHigh = clockLow | _clockMask;
+      for(uint8_t i=0; i<count; i++) {
+        uint8_t b = bytes[i];
+        for(uint8_t bit=0; bit<8; bit++) {
+          *_dataPort = (b & 0x80) ? dataHigh : dataLow;
+          *_clockPort = clockHigh;
+          *_clockPort = clockLow;
+          b <<= 1;
+        }
+      }
+#else
+      for(uint8_t i=0; i<count; i++)
+        shiftOut(_dataPin, _clockPin, MSBFIRST, bytes[i]);
+#endif
+    }
+
+  public:
+    LedDisplay(uint8_t latchPin, uint8_t dataPin, uint8_t clockPin) : _latchPin(latchPin), _dataPin(dataPin), _clockPin(clockPin) {
+      memset(_frames, 0, sizeof(_frames));
+    }
+
+    void Begin() {
+      pinMode(_latchPin, OUTPUT);
+#ifdef DISPLAY_SPI
+      pinMode(53, OUTPUT); // SS must be an output for the SPI master
+      SPI.begin();
+#else
+      pinMode(_dataPin, OUTPUT);
+      pinMode(_clockPin, OUTPUT);
+      digitalWrite(_clockPin, LOW);
+#ifdef __AVR__
+      _latchPort = portOutputRegister(digitalPinToPort(_latchPin));
+      _latchMask = digitalPinToBitMask(_latchPin);
+      _dataPort = portOutputRegister(digitalPinToPort(_dataPin));
+      _dataMask = digitalPinToBitMask(_dataPin);
+      _clockPort = portOutputRegister(digitalPinToPort(_clockPin));
+      _clockMask = digitalPinToBitMask(_clockPin);
+#endif
+#endif
+
+#ifdef __AVR__
+      // timer 3, CTC, prescaler 64 => 4 us ticks
+      noInterrupts();
+      TCCR3A = 0;
+      TCCR3B = (1 << WGM32) | (1 << CS31) | (1 << CS30);
+      TCNT3 = 0;
+      OCR3A = DISPLAY_REFRESH_US / 4 - 1;
+      TIMSK3 |= (1 << OCIE3A);
+      interrupts();
+#endif
+    }
+
+    static uint8_t Reverse(uint8_t b) {
+      b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+      b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+      return (b & 0xAA) >> 1 | (b & 0x55) << 1;
+    }
+
+    // the frame being built, in shifting order (the first byte ends up in the last 595) - not while a swap is pending
+    uint8_t* Row(uint8_t digit) {
+      return _frames[_front ^ 1][digit];
+    }
+
+    // the built frame is shown from the next digit on
+    void Swap() {
+      _swapPending = true;
+      _swaps++;
+    }
+
+    bool IsSwapPending() {
+      return _swapPending;
+    }
+
+    // shift the next slice of the digit out, the digit is latched after its last slice
+    void Refresh() {
+      if(_slice == 0) {
+        if(_swapPending) {
+          _front ^= 1;
+          _swapPending = false;
+        }
+        setLatch(false);
+      }
+      shiftOutBytes(&_frames[_front][_digit][_slice * DISPLAY_SLICE_BYTES], DISPLAY_SLICE_BYTES);
+      if(++_slice < DISPLAY_SLICES) return;
+
+      setLatch(true);
+      _slice = 0;
+      _digit = (_digit + 1) % DISPLAY_DIGITS;
+      _refreshes++;
+    }
+
+    // the timer interrupt refreshes on the Mega - the host has no timers, so it is done from the loop
+    void Run() {
+#ifndef __AVR__
+      unsigned long now = micros();
+      if((long)(now - _nextRefresh) < 0) return;
+      _nextRefresh = now + DISPLAY_REFRESH_US;
+      Refresh();
+#endif
+    }
+
+    void PrintStats() {
+      char s[80];
+      sprintf_P(s, PSTR("display => refreshes: %lu | frames: %lu"), _refreshes, _swaps);
+      Serial.println(s);
+    }
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef Logger_h
+#define Logger_h
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO // messages above it aren't compiled in
+#endif
+
+#define LOG_BUFFER_SIZE 256 // power of two
+#define LOG_LINE_LENGTH 60  // longest line incl. the line end, must fit the serial TX buffer
+#define LOG_BURST 8         // lines that may be logged at once
+#define LOG_RATE_MS 25      // then one line pr 25 ms, ~1/3 of 115200 baud
+
+/*
+* Leveled diagnostics that never wait for the serial port
+*
+* LOG_ERROR/LOG_WARN/LOG_INFO/LOG_DEBUG take a printf format, kept in flash,
+* and format the line into a fixed ring. Flush() is called every loop pass
+* and moves whole lines to the serial TX buffer as far as they fit, so a
+* line is never split by other output and logging costs the same whether
+* the port keeps up or not - what doesn't fit the ring, or comes faster than
+* LOG_RATE_MS after a burst, is dropped and counted instead.
+*
+* Only written from the loop (the clock pulses are handled there too), so
+* the ring needs no locking. Command replies and protocol markers are still
+* printed directly, they must come in order and complete.
+*/
+class Logger {
+  private:
+    char _buffer[LOG_BUFFER_SIZE]; // lines of length byte + text
+    uint8_t _head = 0;
+    uint8_t _tail = 0;
+    uint16_t _used = 0;
+    uint8_t _tokens = LOG_BURST;
+    unsigned long _lastRefill = 0;
+    unsigned long _written = 0;
+    unsigned long _droppedFull = 0;
+    unsigned long _droppedRate = 0;
+
+    bool takeToken() {
+      unsigned long now = millis();
+      unsigned long elapsed = now - _lastRefill;
+      if(elapsed >= LOG_RATE_MS) {
+        _tokens = min(_tokens + min(elapsed / LOG_RATE_MS, (unsigned long)LOG_BURST), (unsigned long)LOG_BURST);
+        _lastRefill = now - elapsed % LOG_RATE_MS;
+      }
+      if(_tokens == 0) return false;
+      _tokens--;
+      return true;
+    }
+
+    void put(char c) {
+      _buffer[_head] = c;
+      _head = (_head + 1) & (LOG_BUFFER_SIZE - 1);
+    }
+
+    char get() {
+      char c = _buffer[_tail];
+      _tail = (_tail + 1) & (LOG_BUFFER_SIZE - 1);
+      return c;
+    }
+
+  public:
+    void Write(uint8_t level, const char* format, ...) {
+      if(!takeToken()) {
+        _droppedRate++;
+        return;
+      }
+
+      static const char levels[] = "EWID";
+      char line[LOG_LINE_LENGTH];
+      line[0] = levels[level - 1];
+      line[1] = ':';
+      line[2] = ' ';
+      va_list args;
+      va_start(args, format);
+      vsnprintf_P(line + 3, sizeof(line) - 5, format, args);
+      va_end(args);
+      uint8_t length = strlen(line);
+      line[length++] = '\r';
+      line[length++] = '\n';
+
+      if(_used + length + 1 > LOG_BUFFER_SIZE) {
+        _droppedFull++;
+        return;
+      }
+      put(length);
+      for(uint8_t i = 0; i < length; i++) put(line[i]);
+      _used += length + 1;
+    }
+
+    // whole lines only, as many as the serial TX buffer takes right now
+    void Flush() {
+      while(_used > 0) {
+        uint8_t length = _buffer[_tail];
+        if(Serial.availableForWrite() < length) return;
+        get();
+        for(uint8_t i = 0; i < length; i++) Serial.write(get());
+        _used -= length + 1;
+        _written++;
+      }
+    }
+
+    void PrintStats() {
+      char s[80];
+      sprintf_P(s, PSTR("log => written: %lu | queued: %u bytes | dropped full: %lu | dropped rate: %lu"),
+                _written, _used, _droppedFull, _droppedRate);
+      Serial.println(s);
+    }
+
+    void ResetStats() {
+      _written = 0;
+      _droppedFull = 0;
+      _droppedRate = 0;
+    }
+};
+
+Logger logger;
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) logger.Write(LOG_LEVEL_ERROR, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) logger.Write(LOG_LEVEL_WARN, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) logger.Write(LOG_LEVEL_INFO, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) logger.Write(LOG_LEVEL_DEBUG, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) ((void)0)
+#endif
+
+#endif
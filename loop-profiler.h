@@ -0,0 +1,137 @@
+#ifndef LoopProfiler_h
+#define LoopProfiler_h
+
+#include <Arduino.h>
+
+/*
+* Loop stage timing, compiled out unless ENABLE_LOOP_PROFILER is defined.
+*
+* loop() calls PROFILE_LOOP_BEGIN() first, PROFILE_MARK(stage) after each
+* stage and PROFILE_LOOP_END() last. The time since the previous mark is
+* added to the stage's histogram (log2 buckets of micros, 1us..32ms+).
+*/
+
+enum LoopStage {
+  STAGE_CLOCK = 0,
+  STAGE_INPUTS,
+  STAGE_CHANNELS,
+  STAGE_UI,
+  STAGE_MUX,
+  STAGE_BUTTONS,
+  STAGE_SERIAL,
+  STAGE_LOOP, // whole pass
+  STAGE_COUNT
+};
+
+#define PROFILE_BUCKETS 16
+#define PROFILE_BUDGET_BPM 180 // loop passes longer than one pulse at this bpm are counted as over budget
+
+#ifdef ENABLE_LOOP_PROFILER
+
+const char* const stageNames[STAGE_COUNT] = {"clock", "inputs", "channels", "ui", "mux", "buttons", "serial", "loop"};
+
+struct StageHistogram {
+  uint32_t buckets[PROFILE_BUCKETS]; // as wide as count, a saturated bucket would skew the percentiles
+  unsigned long count;
+  unsigned long minUs;
+  unsigned long maxUs;
+};
+
+class LoopProfiler {
+  private:
+    StageHistogram _stages[STAGE_COUNT];
+    unsigned long _loopStart = 0;
+    unsigned long _mark = 0;
+    unsigned long _overBudget = 0;
+
+    uint8_t bucketIndex(unsigned long us) {
+      uint8_t index = 0;
+      while (us > 1 && index < PROFILE_BUCKETS - 1) {
+        us >>= 1;
+        index++;
+      }
+      return index;
+    }
+
+    // upper bound of the bucket holding the given percentile, within min..max - the top bucket is open ended
+    unsigned long percentile(const StageHistogram& h, uint8_t percent) {
+      if (h.count == 0) return 0;
+      unsigned long target = (unsigned long)((h.count * (uint64_t)percent + 99) / 100);
+      unsigned long seen = 0;
+      for (uint8_t i = 0; i < PROFILE_BUCKETS - 1; i++) {
+        seen += h.buckets[i];
+        if (seen >= target) return max(min((1UL << (i + 1)) - 1, h.maxUs), h.minUs);
+      }
+      return h.maxUs;
+    }
+
+    void record(LoopStage stage, unsigned long us) {
+      StageHistogram& h = _stages[stage];
+      uint8_t index = bucketIndex(us);
+      h.buckets[index]++;
+      if (h.count == 0 || us < h.minUs) h.minUs = us;
+      if (us > h.maxUs) h.maxUs = us;
+      h.count++;
+    }
+
+  public:
+    LoopProfiler() { reset(); }
+
+    void reset() {
+      memset(_stages, 0, sizeof(_stages));
+      _overBudget = 0;
+    }
+
+    void beginLoop() {
+      _loopStart = micros();
+      _mark = _loopStart;
+    }
+
+    void mark(LoopStage stage) {
+      unsigned long t = micros();
+      record(stage, t - _mark);
+      _mark = t;
+    }
+
+    void endLoop() {
+      unsigned long elapsed = micros() - _loopStart;
+      record(STAGE_LOOP, elapsed);
+      if (elapsed > 60000000UL / (PROFILE_BUDGET_BPM * 24UL)) _overBudget++;
+    }
+
+    void print() {
+      char s[100];
+      Serial.println(F("stage       count      min      p50      p95      p99      max (us)"));
+      for (int i = 0; i < STAGE_COUNT; i++) {
+        const StageHistogram& h = _stages[i];
+        sprintf_P(s, PSTR("%-8s %8lu %8lu %8lu %8lu %8lu %8lu"), stageNames[i], h.count, h.minUs,
+                percentile(h, 50), percentile(h, 95), percentile(h, 99), h.maxUs);
+        Serial.println(s);
+      }
+      sprintf_P(s, PSTR("loop passes over the %d bpm pulse budget (%lu us): %lu"), PROFILE_BUDGET_BPM,
+              60000000UL / (PROFILE_BUDGET_BPM * 24UL), _overBudget);
+      Serial.println(s);
+    }
+};
+
+LoopProfiler loopProfiler;
+
+#define PROFILE_LOOP_BEGIN() loopProfiler.beginLoop()
+#define PROFILE_MARK(stage) loopProfiler.mark(stage)
+#define PROFILE_LOOP_END() loopProfiler.endLoop()
+
+void printLoopProfile() { loopProfiler.print(); }
+void resetLoopProfile() { loopProfiler.reset(); }
+
+#else
+
+#define PROFILE_LOOP_BEGIN()
+#define PROFILE_MARK(stage)
+#define PROFILE_LOOP_END()
+
+void printLoopProfile() { Serial.println(F("Loop profiler not enabled - build with ENABLE_LOOP_PROFILER")); }
+void resetLoopProfile() {}
+
+#endif
+
+#endif
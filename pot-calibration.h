@@ -0,0 +1,204 @@
+#ifndef PotCalibration_h
+#define PotCalibration_h
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "shared.h"
+#include "song-binary-format.h"
+
+#define POT_COUNT (CHANNELS * 3)
+#define POT_CALIBRATION_MAGIC_0 'P'
+#define POT_CALIBRATION_MAGIC_1 'C'
+#define POT_CALIBRATION_VERSION 1
+#define POT_CALIBRATION_SIZE (4 + POT_COUNT * 4 + 2)
+#define POT_CALIBRATION_ADDRESS (EEPROM.length() - EEPROM_RESERVED_SIZE)
+#define POT_MIN_SPAN 200 // raw counts a pot must travel while learning, less => dead, it keeps its range
+
+static_assert(POT_CALIBRATION_SIZE <= EEPROM_RESERVED_SIZE, "pot calibration doesn't fit the reserved EEPROM");
+
+// pot 0 => pages 0..4, pot 1 => repeats 0..32, pot 2 => chain to -1..15
+const uint8_t potDetents[3] = {5, 33, 17};
+const int8_t potFirstValue[3] = {0, 0, -1};
+
+/*
+* Pot calibration and detent mapping
+*
+* Every pot has a learned raw min/max, stored at the top of the EEPROM:
+*   0..1  magic 'P' 'C'
+*   2     version
+*   3     number of pots
+*   4..   min, max pr pot (2 bytes each, little endian)
+*   ..    crc16 of everything before it
+*
+* Unlike a precomputed table of detent edges pr pot, which would take ~440
+* bytes of SRAM, the edges are worked out from the range when a value is
+* mapped (raw / 4, one division pr edge looked at - pots change at human
+* speed). Only the hysteresis band is kept pr pot: a pot only moves to the
+* next detent once it is a quarter detent past the edge, so a value resting
+* on an edge doesn't flicker.
+*
+* Learning: Begin(), turn every pot end to end, End() - pots that didn't
+* travel POT_MIN_SPAN keep their range. The ranges are learned in place of
+* the current ones (Map() isn't used while learning), the stored ranges are
+* read back from the EEPROM for the pots that kept theirs and on Cancel().
+*/
+class PotCalibration {
+  private:
+    uint16_t _min[POT_COUNT]; // while learning => the lowest and highest raw value seen
+    uint16_t _max[POT_COUNT];
+    uint8_t _band[POT_COUNT]; // hysteresis, raw / 4
+    int8_t _detent[POT_COUNT]; // -1 => no value mapped yet
+    bool _learning = false;
+
+    void setDefault(int index) {
+      _min[index] = 0;
+      _max[index] = (index % 3 == 0) ? 1000 : 1023; // the ranges map() used
+    }
+
+    void rangesChanged() {
+      for (int i = 0; i < POT_COUNT; i++) {
+        uint16_t span = (_max[i] >> 2) - (_min[i] >> 2);
+        _band[i] = max(span / (potDetents[i % 3] * 4), 1);
+        _detent[i] = -1;
+      }
+    }
+
+    // lowest raw / 4 of detent d
+    uint8_t edge(int index, int8_t d) {
+      uint8_t detents = potDetents[index % 3];
+      uint16_t low = _min[index] >> 2;
+      uint16_t span = (_max[index] >> 2) - low;
+      return low + (span * d + detents / 2) / detents;
+    }
+
+    // the stored record, false => nothing (valid) is stored
+    bool readStored(uint8_t* buffer) {
+      for (int i = 0; i < POT_CALIBRATION_SIZE; i++) {
+        buffer[i] = EEPROM.read(POT_CALIBRATION_ADDRESS + i);
+      }
+      uint16_t crc = buffer[POT_CALIBRATION_SIZE - 2] | (buffer[POT_CALIBRATION_SIZE - 1] << 8);
+      return buffer[0] == POT_CALIBRATION_MAGIC_0 && buffer[1] == POT_CALIBRATION_MAGIC_1
+          && buffer[2] == POT_CALIBRATION_VERSION && buffer[3] == POT_COUNT
+          && crc16(buffer, POT_CALIBRATION_SIZE - 2) == crc;
+    }
+
+    void restore(int index, const uint8_t* buffer, bool valid) {
+      if (valid) {
+        _min[index] = buffer[4 + index * 4] | (buffer[5 + index * 4] << 8);
+        _max[index] = buffer[6 + index * 4] | (buffer[7 + index * 4] << 8);
+      } else {
+        setDefault(index);
+      }
+    }
+
+    void encode(uint8_t* buffer) {
+      buffer[0] = POT_CALIBRATION_MAGIC_0;
+      buffer[1] = POT_CALIBRATION_MAGIC_1;
+      buffer[2] = POT_CALIBRATION_VERSION;
+      buffer[3] = POT_COUNT;
+      for (int i = 0; i < POT_COUNT; i++) {
+        buffer[4 + i * 4] = _min[i] & 0xFF;
+        buffer[5 + i * 4] = _min[i] >> 8;
+        buffer[6 + i * 4] = _max[i] & 0xFF;
+        buffer[7 + i * 4] = _max[i] >> 8;
+      }
+      uint16_t crc = crc16(buffer, POT_CALIBRATION_SIZE - 2);
+      buffer[POT_CALIBRATION_SIZE - 2] = crc & 0xFF;
+      buffer[POT_CALIBRATION_SIZE - 1] = crc >> 8;
+    }
+
+  public:
+    PotCalibration() {
+      for (int i = 0; i < POT_COUNT; i++) setDefault(i);
+      rangesChanged();
+    }
+
+    // falls back to the default ranges if nothing (valid) is stored
+    bool Load() {
+      uint8_t buffer[POT_CALIBRATION_SIZE];
+      bool valid = readStored(buffer);
+      for (int i = 0; i < POT_COUNT; i++) restore(i, buffer, valid);
+      rangesChanged();
+      return valid;
+    }
+
+    // only the changed bytes are written
+    void Save() {
+      uint8_t buffer[POT_CALIBRATION_SIZE];
+      encode(buffer);
+      for (int i = 0; i < POT_CALIBRATION_SIZE; i++) {
+        if (EEPROM.read(POT_CALIBRATION_ADDRESS + i) != buffer[i])
+          EEPROM.write(POT_CALIBRATION_ADDRESS + i, buffer[i]);
+      }
+    }
+
+    void Begin() {
+      _learning = true;
+      for (int i = 0; i < POT_COUNT; i++) {
+        _min[i] = 0xFFFF;
+        _max[i] = 0;
+      }
+    }
+
+    bool IsLearning() {
+      return _learning;
+    }
+
+    void Learn(int channel, int pot, uint16_t raw) {
+      int index = channel * 3 + pot;
+      if (raw < _min[index]) _min[index] = raw;
+      if (raw > _max[index]) _max[index] = raw;
+    }
+
+    // returns the number of pots calibrated, the new ranges are saved
+    uint8_t End() {
+      _learning = false;
+      uint8_t buffer[POT_CALIBRATION_SIZE];
+      bool valid = readStored(buffer);
+      uint8_t calibrated = 0;
+      for (int i = 0; i < POT_COUNT; i++) {
+        if (_max[i] < _min[i] || _max[i] - _min[i] < POT_MIN_SPAN) {
+          restore(i, buffer, valid);
+          continue;
+        }
+        calibrated++;
+      }
+      rangesChanged();
+      Save();
+      return calibrated;
+    }
+
+    void Cancel() {
+      _learning = false;
+      Load();
+    }
+
+    // raw pot value => pages, repeats or chain to
+    int Map(int channel, int pot, uint16_t raw) {
+      int index = channel * 3 + pot;
+      int8_t last = potDetents[pot] - 1;
+      int level = raw >> 2;
+      int band = _band[index];
+      int8_t d = _detent[index];
+
+      if (d < 0) {
+        d = 0;
+        while (d < last && level >= edge(index, d + 1)) d++;
+      } else {
+        while (d < last && level >= edge(index, d + 1) + band) d++;
+        while (d > 0 && level + band < edge(index, d)) d--;
+      }
+      _detent[index] = d;
+      return d + potFirstValue[pot];
+    }
+
+    uint16_t Min(int channel, int pot) {
+      return _min[channel * 3 + pot];
+    }
+
+    uint16_t Max(int channel, int pot) {
+      return _max[channel * 3 + pot];
+    }
+};
+
+#endif
@@ -2,45 +2,27 @@
 #define SerialFunctions_h
 
 #include "shared.h"
+#include "command-tokenizer.h"
+#include "serial-line-reader.h"
 
-
+// "<test> <channel>" from the serial line reader, false until a complete line with two ints has arrived
 bool getSerialData(int& test, int& channel) {
-  while(Serial.available()) {
-      String data = Serial.readString();
-      data.trim();
-
-      // find seperators
-      int seperators[4] = {};
-      int length = 0;
-      for(int i=0; i<data.length(); i++) {
-        if(data.charAt(i) == ' ') {
-          seperators[length] = i;
-          length++;
-        }
-      }
+  if(!serialLines.Read()) return false;
 
-      // extract data values
-      int values[5] = {};      
-      int offset = 0;
-      int valueCount = 0;
-      for(int i=0; i<length; i++) {
-        int value;
-        if(tryGetInt(data, offset, seperators[i], value))
-          values[valueCount++] = value;
-        offset = seperators[i];
-      }
-      // get the last value
-      if(seperators[length-1]<data.length()) {
-        int value;
-        if(tryGetInt(data, seperators[length-1]+1, data.length(), value))
-          values[valueCount++] = value;
-      }
+  const char* line = serialLines.Line();
+  SpanSplitter splitter(makeSpan(line, line + strlen(line)), ' ');
+  TextSpan token;
+  int values[2] = {};
+  int valueCount = 0;
+  while(splitter.next(token)) {
+    if(valueCount == 2 || !spanToInt(token, values[valueCount])) return false;
+    valueCount++;
+  }
 
-      if(valueCount!=2) return false;
-      test = values[0];
-      channel = values[1];
-      return true;
-    }
+  if(valueCount!=2) return false;
+  test = values[0];
+  channel = values[1];
+  return true;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,63 @@
+#ifndef SerialLineReader_h
+#define SerialLineReader_h
+
+#include <Arduino.h>
+
+#define SERIAL_LINE_LENGTH 128 // longest line + 1, longer lines are dropped
+
+/*
+* Assembles serial input into lines without waiting for them: every call
+* takes the bytes that have arrived (what the serial receive ring holds) and
+* returns true once a line is complete - a line arriving in pieces costs a
+* few microseconds pr pass instead of blocking for the Serial timeout.
+*
+* Reading stops right after the line end, so what follows a command (the
+* frames after "upload") stays in the receive buffer for whoever handles it.
+* Lines end with \n, \r or both, empty lines are skipped. A line that doesn't
+* fit is dropped whole and counted.
+*/
+class SerialLineReader {
+  private:
+    Stream& _stream;
+    char _line[SERIAL_LINE_LENGTH];
+    uint8_t _length = 0;
+    bool _overflow = false;
+    unsigned long _dropped = 0;
+
+  public:
+    SerialLineReader(Stream& stream) : _stream(stream) {
+      _line[0] = '\0';
+    }
+
+    bool Read() {
+      while(_stream.available() > 0) {
+        char c = _stream.read();
+        if(c == '\n' || c == '\r') {
+          bool complete = _length > 0 && !_overflow;
+          if(_overflow) _dropped++;
+          _line[_length] = '\0';
+          _length = 0;
+          _overflow = false;
+          if(complete) return true;
+        } else if(_length < SERIAL_LINE_LENGTH - 1) {
+          _line[_length++] = c;
+        } else {
+          _overflow = true;
+        }
+      }
+      return false;
+    }
+
+    // the last complete line, valid until the next Read()
+    const char* Line() {
+      return _line;
+    }
+
+    unsigned long Dropped() {
+      return _dropped;
+    }
+};
+
+SerialLineReader serialLines(Serial);
+
+#endif
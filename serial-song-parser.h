@@ -1,182 +1,187 @@
 #ifndef SerialSongParser_h
 #define SerialSongParser_h
 
+#include "shared.h"
+#include "command-tokenizer.h"
+#include "command-table.h"
+
+struct SongModule {
+  char name[8];
+  uint8_t target; // SlaveEnum
+};
+
+// the song programmer's values, for its error messages
+const char programmerValueNames[3][14] PROGMEM = {"pos 0/pages", "pos 1/repeats", "pos 2/chainTo"};
+
+// sorted by name, see command-table.h - no module => the song programmer
+constexpr SongModule songModules[] PROGMEM = {
+  {"sampler", SAMPLER},
+  {"seq", DRUM_SEQUENCER},
+  {"tempo", TEMPO},
+};
+static_assert(tableSorted(songModules), "songModules must be sorted by name");
 
 class SerialSongParser {
   private:
     Song& _song;
-    const int allowedDividers[7] = {3,6,8,9,12,15,24};
-
-    bool isDividerAllowed(int divider) {
-      for (int i = 0; i < 7; i++) {
-        if (allowedDividers[i] == divider) {
-          return true;
-        }
-      }
-      return false;
-    }
 
-    bool parseDrumSequencerCommand(int partIndex, String path, String data) {
+    bool parseDrumSequencerCommand(int partIndex, TextSpan path, TextSpan data) {
       bool error = false;
-      int pathSize;
-      String* paths = splitString(path, '.', pathSize);
-      
+
       int channel = -1;
-      String function = "";
-      if(pathSize==1) {
-        channel = paths[0].toInt();
-      } else if(pathSize==2) {
-        channel = paths[0].toInt();
-        function = paths[1];
+      TextSpan function;
+      int dot = spanIndexOf(path, '.');
+      if(dot == -1) {
+        spanToInt(path, channel);
+      } else {
+        spanToInt(makeSpan(path.start, path.start + dot), channel);
+        function = trimSpan(makeSpan(path.start + dot + 1, path.start + path.length));
       }
-      delete[] paths;
 
-      if(channel == -1) {
-        Serial.println("Invalid channel");
+      if(channel < 0 || channel >= 5) {
+        Serial.println(F("Invalid channel"));
         return false;
       }
 
-      int valueSize;
-      String* values = splitString(data, ' ', valueSize);
-      
-      if(function=="div") {
+      DrumPatternChannel& target = _song.parts[partIndex].drumSequencer.channel[channel];
+      uint8_t valueSize = countTokens(data, ' ');
+
+      if(spanEquals(function, "div")) {
         int divider;
-        if(valueSize == 1 && tryGetInt(values[0], divider) && isDividerAllowed(divider)) {
-          _song.parts[partIndex].drumSequencer.channel[channel].divider = divider;
+        if(valueSize == 1 && spanToInt(data, divider) && isDividerAllowed(divider)) {
+          target.SetDivider(divider);
         } else {
-          Serial.println("Invalid argument setting divider");          
+          Serial.println(F("Invalid argument setting divider"));
           error = true;
         }
-      } else if(function=="ena") {
+      } else if(spanEquals(function, "ena")) {
         if(valueSize == 1) {
-          _song.parts[partIndex].drumSequencer.channel[channel].enabled = values[0] == "1";
+          target.SetEnabled(spanEquals(data, "1"));
         } else {
-          Serial.println("Invalid argument setting enabled");          
+          Serial.println(F("Invalid argument setting enabled"));
           error = true;
         }
-      } else if(function=="last") {
+      } else if(spanEquals(function, "last")) {
         int laststep;
-        if(valueSize == 1 && tryGetInt(values[0], laststep) && laststep >= 0 && laststep <= 63) {
-          _song.parts[partIndex].drumSequencer.channel[channel].lastStep = laststep;
+        if(valueSize == 1 && spanToInt(data, laststep) && laststep >= 0 && laststep <= 63) {
+          target.SetLastStep(laststep);
         } else {
-          Serial.println("Invalid argument setting laststep");          
+          Serial.println(F("Invalid argument setting laststep"));
           error = true;
         }
       } else {
         // we are setting the steps - each value part corresponds to a page
+        SpanSplitter values(data, ' ');
+        TextSpan value;
         uint16_t steps;
-        for(int i=0; i<valueSize; i++) {
-          if(!tryParseInt(values[i], steps)) {
+        for(int i=0; i<4 && values.next(value); i++) {
+          if(!spanToSteps(value, steps)) {
             steps = 0;
           }
-          _song.parts[partIndex].drumSequencer.channel[channel].page[i] = steps;
+          target.page[i] = steps;
         }
       }
 
-      delete[] values;
-
-      //printDrumSequencerChannel(_song.parts[partIndex].drumSequencer.channel[channel], channel);
+      //printDrumSequencerChannel(target, channel);
       return !error;
     }
 
-    bool parseTempoCommand(int partIndex, String path, String values) {
+    bool parseTempoCommand(int partIndex, TextSpan, TextSpan values) {
       bool error = false;
       int bpm;
-      if(tryGetInt(values, bpm)) {
+      if(spanToInt(values, bpm)) {
         _song.parts[partIndex].tempo.bpm = bpm;
       } else {
-        Serial.println("Invalid bpm-value");
+        Serial.println(F("Invalid bpm-value"));
         error = true;
       }
       return !error;
     }
 
-    bool parseSamplerCommand(int partIndex, String path, String values) {
+    bool parseSamplerCommand(int partIndex, TextSpan path, TextSpan values) {
       bool error = false;
-      int pathSize;
-      String* paths = splitString(path, '.', pathSize);
-      
+
       int channel = -1;
-      String function = "";
-      if(path.length()==0) {
-        function = "bank";
-      } else if(pathSize==2) {
-        channel = paths[0].toInt();
-        function = paths[1];
+      bool mix = false;
+      int dot = spanIndexOf(path, '.');
+      if(path.length > 0 && dot != -1) {
+        spanToInt(makeSpan(path.start, path.start + dot), channel);
+        mix = spanEquals(trimSpan(makeSpan(path.start + dot + 1, path.start + path.length)), "mix");
       }
-      delete[] paths;
 
-      if(function == "mix" && channel == -1) {
-        Serial.println("Invalid channel");
+      if(mix && (channel < 0 || channel >= 5)) {
+        Serial.println(F("Invalid channel"));
         return false;
       }
 
-      if (function == "mix") {
-        int mix;
-        if(tryGetInt(values, mix) && mix >= 0 && mix <= 1023) {
-          _song.parts[partIndex].sampler.mix[channel] = mix;
+      if (mix) {
+        int value;
+        if(spanToInt(values, value) && value >= 0 && value <= 1023) {
+          _song.parts[partIndex].sampler.mix[channel] = value;
         } else {
-          Serial.println("Invalid mix-value");
+          Serial.println(F("Invalid mix-value"));
           error = true;
         }
       } else {
         int bank;
-        if(tryGetInt(values, bank) && bank >= 0 && bank <= 99) {
+        if(spanToInt(values, bank) && bank >= 0 && bank <= 99) {
           _song.parts[partIndex].sampler.bank = bank;
         } else {
-          Serial.println("Invalid bank-value");
+          Serial.println(F("Invalid bank-value"));
           error = true;
         }
       }
       return !error;
     }
 
-    bool parseSongProgrammerCommand(int partIndex, String values) {
+    bool parseSongProgrammerCommand(int partIndex, TextSpan values) {
       bool error = false;
 
-      int pages;
-      int repeats;
-      int chainTo;
+      int numbers[3] = {0};
+      TextSpan parts[3];
 
-      int size;
-      String* parts = splitString(values, ' ', size);
+      SpanSplitter splitter(values, ' ');
+      uint8_t size = 0;
+      TextSpan token;
+      while(splitter.next(token)) {
+        if(size < 3) parts[size] = token;
+        size++;
+      }
       if(size != 3) {
-        Serial.print("Invalid arguments for song programmer: ");
-        Serial.println(values);
-        error = true;
+        Serial.print(F("Invalid arguments for song programmer: "));
+        printSpan(values);
+        Serial.println();
+        return false;
       }
 
-      if(!tryGetInt(parts[0], pages)) {
-        Serial.print("Invalid value for pos 0/pages: ");
-        Serial.println(parts[0]);
-        error = true;
-      }
-      if(!tryGetInt(parts[1], repeats)) {
-        Serial.print("Invalid value for pos 1/repeats: ");
-        Serial.println(parts[1]);
-        error = true;
+      for(int i=0; i<3; i++) {
+        if(!spanToInt(parts[i], numbers[i])) {
+          Serial.print(F("Invalid value for "));
+          Serial.print((const __FlashStringHelper*)programmerValueNames[i]);
+          Serial.print(F(": "));
+          printSpan(parts[i]);
+          Serial.println();
+          error = true;
+        }
       }
-      if(!tryGetInt(parts[2], chainTo)) {
-        Serial.print("Invalid value for pos 2/chainTo: ");
-        Serial.println(parts[2]);
-        error = true;
-      }      
 
-      delete[] parts;
+      int pages = numbers[0];
+      int repeats = numbers[1];
+      int chainTo = numbers[2];
 
       // Validate ranges
       if (pages < 0 || pages > 4) {
-        Serial.println("Invalid pages value!");
+        Serial.println(F("Invalid pages value!"));
         error = true;
       }
       if (repeats < 0 || repeats > 32) {
-        Serial.println("Invalid repeats value!");
+        Serial.println(F("Invalid repeats value!"));
         error = true;
       }
       if (chainTo < -1 || chainTo > 15) {
-        Serial.println("Invalid chainTo value!");
+        Serial.println(F("Invalid chainTo value!"));
         error = true;
-      }      
+      }
 
       if(error) return false;
 
@@ -190,94 +195,50 @@ class SerialSongParser {
   public:
     SerialSongParser(Song& song) : _song(song) {}
 
-    int parseCommand(String command, SlaveEnum &target) {
-      target = NONE;
-      command.trim();
-
-      if(command=="init") return -1;
-      if(command=="apply") return -1;
-      if(command.indexOf("#")==0) return -1;
+    int parseCommand(const String& command, SlaveEnum &target) {
+      return parseCommand(command.c_str(), target);
+    }
 
+    int parseCommand(const char* command, SlaveEnum &target) {
+      target = NONE;
+      TextSpan line = trimSpan(makeSpan(command, command + strlen(command)));
 
-      int partIndex;
-      String module;
-      String path;
-      String values;
+      if(spanEquals(line, "init")) return -1;
+      if(spanEquals(line, "apply")) return -1;
+      if(line.length > 0 && line.start[0] == '#') return -1;
 
-      // Split the command into parts
-      if(command.indexOf('=') == -1) {
-        Serial.print("Invalid command - missing '=' : ");
+      CommandTokens tokens;
+      if(!tokenizeCommand(command, tokens)) {
+        Serial.print(F("Invalid command - missing '=' : "));
         Serial.println(command);
         return -1; // invalid command
       }
-      
-      int size=0;
-      String* parts = splitString(command, ':', size);
-
-      // char s[100];
-      // sprintf(s, "command: %s  (%d parts) => ", command.c_str(), size);
-      // Serial.print(s);      
-      // for(int i=0; i<size; i++) {
-      //   Serial.print(parts[i]);
-      //   if(i<size-1) {
-      //     Serial.print(",");
-      //   }
-      // }
-      // Serial.println();
-
-      if(size==1) { // no module
-        // e.g. 0=2 0 2
-        int pos = command.indexOf('=');
-        partIndex = parts[0].toInt();
-        module = "song";
-        path = "";
-        values = command.substring(pos + 1);
-      } else if(size==2) {
-        // e.g. 0:tempo=120
-        //      0:sampler=1
-        int pos = parts[1].indexOf('=');
-        partIndex = parts[0].toInt();
-        module = parts[1].substring(0, pos);
-        path = "";
-        values = parts[1].substring(pos + 1);
-      } else if(size==3) {
-        // e.g. 0:seq:0=1000100010001000
-        //      0:seq:0.last=31
-        //      0:sampler:0.mix=512
-        int pos = parts[2].indexOf('=');
-        partIndex = parts[0].toInt();
-        module = parts[1];
-        path = parts[2].substring(0, pos);
-        values = parts[2].substring(pos + 1);
-      } else {
-        Serial.print("Invalid command: ");
+
+      int partIndex = -1;
+      if(!spanToInt(tokens.partIndex, partIndex) || partIndex < 0 || partIndex >= CHANNELS) {
+        Serial.print(F("Invalid command: "));
         Serial.println(command);
         return -1;
       }
 
-      delete[] parts;
-
-      // sprintf(s, "partIndex: %d | module: %s | path: %s | values: %s", partIndex, module.c_str(), path.c_str(), values.c_str());
-      // Serial.println(s);
-
-      module.trim();
-      path.trim();
-      values.trim();
-
       bool result = true;
 
-      if (module == "seq") {
-        result = parseDrumSequencerCommand(partIndex, path, values);
-        target = DRUM_SEQUENCER;
-      } else if (module == "tempo") {
-        result = parseTempoCommand(partIndex, path, values);
-        target = TEMPO;
-      } else if (module == "sampler") {
-        result = parseSamplerCommand(partIndex, path, values);
-        target = SAMPLER;
-      } else {
-        result = parseSongProgrammerCommand(partIndex, values);
-        target = PROGRAMMER;
+      uint8_t length = 0;
+      int8_t module = matchTable(songModules, tokens.module, length);
+      target = (module >= 0 && length == tokens.module.length) ? (SlaveEnum)pgm_read_byte(&songModules[module].target) : PROGRAMMER;
+      switch(target) {
+        case DRUM_SEQUENCER:
+          result = parseDrumSequencerCommand(partIndex, tokens.path, tokens.values);
+          break;
+        case TEMPO:
+          result = parseTempoCommand(partIndex, tokens.path, tokens.values);
+          break;
+        case SAMPLER:
+          result = parseSamplerCommand(partIndex, tokens.path, tokens.values);
+          break;
+        default:
+          result = parseSongProgrammerCommand(partIndex, tokens.values);
+          break;
       }
 
       if(!result) return -1;
@@ -286,4 +247,4 @@ class SerialSongParser {
     }
 };
 
-#endif
\ No newline at end of file
+#endif
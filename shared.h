@@ -10,6 +10,8 @@
 
 #define CHANNELS 8
 
+#define EEPROM_RESERVED_SIZE 128 // top of the EEPROM, not used for songs - holds the pot calibration
+
 
 enum SlaveEnum {
   TEMPO = 0,
@@ -24,19 +26,19 @@ void printByte(uint8_t b, uint8_t bitOrder = LSBFIRST) {
   if(bitOrder == LSBFIRST) {
     for(int j=7; j>=0; j--) {
       if((b >> j) & 1)
-        Serial.print("1");
+        Serial.print(F("1"));
       else
-        Serial.print("0");
+        Serial.print(F("0"));
     }    
   } else {
     for(int j=0; j<8; j++) {
       if((b >> j) & 1)
-        Serial.print("1");
+        Serial.print(F("1"));
       else
-        Serial.print("0");
+        Serial.print(F("0"));
     }        
   }
-  Serial.print(" ");
+  Serial.print(F(" "));
 }
 
 void printByteln(uint8_t b, uint8_t bitOrder = LSBFIRST) {
@@ -46,10 +48,10 @@ void printByteln(uint8_t b, uint8_t bitOrder = LSBFIRST) {
 
 void printInt(uint16_t value) {
   for(int i=0; i<16; i++) {
-    if((value >> i) & 1) Serial.print("1");
-    else Serial.print("0");
+    if((value >> i) & 1) Serial.print(F("1"));
+    else Serial.print(F("0"));
   }
-  Serial.print(" ");
+  Serial.print(F(" "));
 }
 
 void printIntln(uint16_t value) {
@@ -76,30 +78,6 @@ uint8_t byteToBitMask(uint8_t b, uint8_t bitOrder = LSBFIRST) {
   return mask;
 }
 
-String* splitString(String data, char delimiter, int &size) {
-    int count = 0;
-    for (int i = 0; i < data.length(); i++) {
-        if (data.charAt(i) == delimiter) {
-            count++;
-        }
-    }
-
-    size = count + 1; // Number of substrings
-    String* result = new String[size];
-
-    int startIndex = 0;
-    int resultIndex = 0;
-    for (int i = 0; i <= data.length(); i++) {
-        if (i == data.length() || data.charAt(i) == delimiter) {
-            result[resultIndex] = data.substring(startIndex, i);
-            startIndex = i + 1;
-            resultIndex++;
-        }
-    }
-
-    return result;
-}
-
 //String allowedChars = "0123456789";
 bool isIntValue(String s) {
     if (s.length() == 0) return false;
@@ -166,6 +144,32 @@ bool tryParseInt(String data, uint16_t& value) {
     return false; // Unsupported format
 }
 
+#define DIVIDER_COUNT 7
+const uint8_t allowedDividers[DIVIDER_COUNT] = {3,6,8,9,12,15,24};
+
+bool isDividerAllowed(int divider) {
+  for (int i = 0; i < DIVIDER_COUNT; i++) {
+    if (allowedDividers[i] == divider) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// index into allowedDividers - unknown dividers fall back to the default of 6
+uint8_t dividerToIndex(int divider) {
+  for (uint8_t i = 0; i < DIVIDER_COUNT; i++) {
+    if (allowedDividers[i] == divider) {
+      return i;
+    }
+  }
+  return 1;
+}
+
+uint8_t indexToDivider(uint8_t index) {
+  return (index < DIVIDER_COUNT) ? allowedDividers[index] : 6;
+}
+
 struct KosmoSlave {
   int address;
   bool inProgrammingMode;
@@ -187,6 +191,7 @@ struct SamplerRegisters {
   uint16_t mix[5] = {0};
 };
 
+// register layout of the drum sequencer slave - only used on the wire, songs hold a DrumPattern
 struct DrumSequencerChannel {
   uint16_t page[4] = {0};
   int divider = 6;
@@ -199,13 +204,38 @@ struct DrumSequencer {
   bool chainModeEnabled;  
 };
 
+// packed drum sequencer channel: 10 bytes instead of 13
+struct DrumPatternChannel {
+  uint16_t page[4];
+  uint16_t lastStep : 6;
+  uint16_t dividerIndex : 3; // index into allowedDividers
+  uint16_t enabled : 1;
+
+  DrumPatternChannel() : page{0}, lastStep(0), dividerIndex(1), enabled(0) {}
+
+  uint8_t LastStep() const { return lastStep; }
+  void SetLastStep(int value) { lastStep = constrain(value, 0, 63); }
+  int Divider() const { return indexToDivider(dividerIndex); }
+  void SetDivider(int divider) { dividerIndex = dividerToIndex(divider); }
+  bool Enabled() const { return enabled; }
+  void SetEnabled(bool value) { enabled = value; }
+};
+
+struct DrumPattern {
+  DrumPatternChannel channel[5];
+  bool chainModeEnabled = false;
+};
+
 struct Part {
-  uint8_t pages = 0;
-  uint8_t repeats = 0;
-  int8_t chainTo = -1;
+  // the parser range checks these: pages 0..4, repeats 0..32, chainTo -1..15
+  uint16_t pages : 3;
+  uint16_t repeats : 6;
+  int16_t chainTo : 5;
   TempoRegisters tempo;
-  DrumSequencer drumSequencer;
+  DrumPattern drumSequencer;
   SamplerRegisters sampler;
+
+  Part() : pages(0), repeats(0), chainTo(-1) {}
 };
 
 struct Song {
@@ -223,17 +253,44 @@ TempoRegisters sharedTempoRegisters;
 DrumSequencer sharedDrumSequencerRegisters;
 SamplerRegisters sharedSamplerRegisters;
 
-int firstSongPart(Song song) {
+void toDrumSequencerRegisters(const DrumPattern& pattern, DrumSequencer& regs) {
+  for(int i=0; i<5; i++) {
+    const DrumPatternChannel& channel = pattern.channel[i];
+    for(int p=0; p<4; p++) {
+      regs.channel[i].page[p] = channel.page[p];
+    }
+    regs.channel[i].divider = channel.Divider();
+    regs.channel[i].lastStep = channel.LastStep();
+    regs.channel[i].enabled = channel.Enabled();
+  }
+  regs.chainModeEnabled = pattern.chainModeEnabled;
+}
+
+void fromDrumSequencerRegisters(const DrumSequencer& regs, DrumPattern& pattern) {
+  for(int i=0; i<5; i++) {
+    DrumPatternChannel& channel = pattern.channel[i];
+    for(int p=0; p<4; p++) {
+      channel.page[p] = regs.channel[i].page[p];
+    }
+    channel.SetDivider(regs.channel[i].divider);
+    channel.SetLastStep(regs.channel[i].lastStep);
+    channel.SetEnabled(regs.channel[i].enabled);
+  }
+  pattern.chainModeEnabled = regs.chainModeEnabled;
+}
+
+int firstSongPart(const Song& song) {
   int index = -1;
   for(int i=0; i<CHANNELS; i++) {
     if(index == -1) {
       for(int j=0; j<5; j++) {
-        if(song.parts[i].drumSequencer.channel[j].lastStep > 0) {
+        if(song.parts[i].drumSequencer.channel[j].LastStep() > 0) {
           index = i;
         }
       }
     }
   }
+  return index;
 }
 
 void resetSamplerRegisters(SamplerRegisters &regs) {
@@ -260,13 +317,20 @@ void resetDrumSequencerRegisters(DrumSequencer &regs) {
     }
 }
 
+void resetDrumPattern(DrumPattern &pattern) {
+    pattern.chainModeEnabled = false;
+    for(int i=0; i<5; i++) {
+      pattern.channel[i] = DrumPatternChannel();
+    }
+}
+
 void resetPart(Part &part) {
     part.pages = 0;
     part.repeats = 0;
     part.chainTo = -1; 
     
     resetTempoRegisters(part.tempo);
-    resetDrumSequencerRegisters(part.drumSequencer);
+    resetDrumPattern(part.drumSequencer);
     resetSamplerRegisters(part.sampler);
 }
 
@@ -276,54 +340,56 @@ void resetSong(Song &song) {
     }
 }
 
-void printSamplerRegisters(SamplerRegisters reg) {
+void printSamplerRegisters(const SamplerRegisters& reg) {
   char s[100];
-  sprintf(s, "sampler => bank: %d", reg.bank);
+  sprintf_P(s, PSTR("sampler => bank: %d"), reg.bank);
   Serial.println(s);
   for(int i=0; i<5; i++) {
-    sprintf(s, "ch%d => mix: %d", i, reg.mix[i]);
+    sprintf_P(s, PSTR("ch%d => mix: %d"), i, reg.mix[i]);
     Serial.println(s);
   }  
 }
 
-void printTempoRegisters(TempoRegisters reg) {
+void printTempoRegisters(const TempoRegisters& reg) {
   char s[100];
-  sprintf(s, "tempo => bpm: %d | target bpm: %d | morph bars: %d | morph enabled: ", reg.bpm, reg.morphTargetBpm, reg.morphBars);
+  sprintf_P(s, PSTR("tempo => bpm: %d | target bpm: %d | morph bars: %d | morph enabled: "), reg.bpm, reg.morphTargetBpm, reg.morphBars);
   Serial.print(s);
   Serial.println(reg.morphEnabled);
 }
 
-void printDrumSequencerChannel(DrumSequencerChannel channel, int index) {
+void printDrumSequencerChannel(const DrumSequencerChannel& channel, int index) {
   char s[100];
-  sprintf(s, "ch%d => laststep: %d | divider: %d | output enabled: ", index, channel.lastStep, channel.divider);
+  sprintf_P(s, PSTR("ch%d => laststep: %d | divider: %d | output enabled: "), index, channel.lastStep, channel.divider);
   Serial.print(s);
   Serial.println(channel.enabled);
-  Serial.print("steps: ");  
+  Serial.print(F("steps: "));  
   for(int i=0; i<4; i++) {
     printInt(channel.page[i]);
   }
   Serial.println();
 }
 
-void printDrumSequencer(DrumSequencer drums) {
+void printDrumSequencer(const DrumSequencer& drums) {
   for(int i=0; i<5; i++) {
     printDrumSequencerChannel(drums.channel[i], i);
   }
-  Serial.print("chain mode enabled: ");
+  Serial.print(F("chain mode enabled: "));
   Serial.println(drums.chainModeEnabled);
 }
 
-void printSongPart(Part part, int index) {
+void printSongPart(const Part& part, int index) {
   char s[100];
-  sprintf(s, "part %d => pages: %d | repeats: %d | chainTo: %d", index, part.pages, part.repeats, part.chainTo);
+  sprintf_P(s, PSTR("part %d => pages: %d | repeats: %d | chainTo: %d"), index, part.pages, part.repeats, part.chainTo);
   Serial.println(s);
   printTempoRegisters(part.tempo);
-  printDrumSequencer(part.drumSequencer);
+  DrumSequencer drums;
+  toDrumSequencerRegisters(part.drumSequencer, drums);
+  printDrumSequencer(drums);
   printSamplerRegisters(part.sampler);
 }
 
-void printSong(Song song) {
-  Serial.println("SONG:");
+void printSong(const Song& song) {
+  Serial.println(F("SONG:"));
 
   for(int i=0; i<CHANNELS; i++) {
     printSongPart(song.parts[i], i);
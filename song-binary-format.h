@@ -0,0 +1,177 @@
+#ifndef SongBinaryFormat_h
+#define SongBinaryFormat_h
+
+#include <Arduino.h>
+#include "shared.h"
+
+/*
+* Binary song record (version 1)
+*
+* header (8 bytes):
+*   0..1  magic 'K' 'S'
+*   2     format version
+*   3     part mask - bit n set => part n is stored, missing parts are reset parts
+*   4..5  payload length in bytes (little endian)
+*   6..7  crc16 of the payload (little endian)
+*
+* payload: one 64 byte block pr stored part, in part order
+*   0..1  pages (3 bits) | repeats (6 bits) << 3 | (chainTo+1) (5 bits) << 9
+*   2..5  tempo: bpm, morph target bpm, morph bars, morph enabled
+*   6     sampler bank
+*   7..16 sampler mix[5] (16 bit)
+*   17..61 drum sequencer channel[5]: page[4] (16 bit) + lastStep (6 bits) | enabled << 6
+*   62..63 divider index[5] (3 bits each) | chain mode enabled << 15
+*/
+
+#define SONG_FORMAT_MAGIC_0 'K'
+#define SONG_FORMAT_MAGIC_1 'S'
+#define SONG_FORMAT_VERSION 1
+#define SONG_HEADER_SIZE 8
+#define SONG_PART_RECORD_SIZE 64
+#define SONG_RECORD_MAX_SIZE (SONG_HEADER_SIZE + CHANNELS * SONG_PART_RECORD_SIZE)
+
+struct SongRecordHeader {
+  uint8_t version;
+  uint8_t partMask;
+  uint16_t length;
+  uint16_t crc;
+};
+
+uint16_t crc16Update(uint16_t crc, uint8_t data) {
+  // CRC-16/CCITT, polynomial 0x1021
+  crc ^= (uint16_t)data << 8;
+  for (uint8_t i = 0; i < 8; i++) {
+    if (crc & 0x8000)
+      crc = (crc << 1) ^ 0x1021;
+    else
+      crc <<= 1;
+  }
+  return crc;
+}
+
+uint16_t crc16(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF) {
+  for (size_t i = 0; i < length; i++) {
+    crc = crc16Update(crc, data[i]);
+  }
+  return crc;
+}
+
+void writeUInt16(uint8_t* buffer, uint16_t value) {
+  buffer[0] = value & 0xFF;
+  buffer[1] = value >> 8;
+}
+
+uint16_t readUInt16(const uint8_t* buffer) {
+  return (uint16_t)buffer[0] | ((uint16_t)buffer[1] << 8);
+}
+
+class SongBinaryFormat {
+  public:
+    static void encodeHeader(const SongRecordHeader& header, uint8_t* buffer) {
+      buffer[0] = SONG_FORMAT_MAGIC_0;
+      buffer[1] = SONG_FORMAT_MAGIC_1;
+      buffer[2] = header.version;
+      buffer[3] = header.partMask;
+      writeUInt16(&buffer[4], header.length);
+      writeUInt16(&buffer[6], header.crc);
+    }
+
+    static bool decodeHeader(const uint8_t* buffer, SongRecordHeader& header) {
+      if (buffer[0] != SONG_FORMAT_MAGIC_0 || buffer[1] != SONG_FORMAT_MAGIC_1) return false;
+      header.version = buffer[2];
+      header.partMask = buffer[3];
+      header.length = readUInt16(&buffer[4]);
+      header.crc = readUInt16(&buffer[6]);
+      if (header.version != SONG_FORMAT_VERSION) return false;
+      return header.length == payloadLength(header.partMask);
+    }
+
+    static uint16_t payloadLength(uint8_t partMask) {
+      uint16_t length = 0;
+      for (int i = 0; i < CHANNELS; i++) {
+        if (partMask & (1 << i)) length += SONG_PART_RECORD_SIZE;
+      }
+      return length;
+    }
+
+    static void encodePart(const Part& part, uint8_t* buffer) {
+      uint8_t pages = min((int)part.pages, 7);
+      uint8_t repeats = min((int)part.repeats, 63);
+      uint8_t chainTo = (uint8_t)(constrain(part.chainTo, -1, 15) + 1);
+      writeUInt16(&buffer[0], pages | (repeats << 3) | ((uint16_t)chainTo << 9));
+
+      buffer[2] = part.tempo.bpm;
+      buffer[3] = part.tempo.morphTargetBpm;
+      buffer[4] = part.tempo.morphBars;
+      buffer[5] = part.tempo.morphEnabled ? 1 : 0;
+
+      buffer[6] = part.sampler.bank;
+      for (int i = 0; i < 5; i++) {
+        writeUInt16(&buffer[7 + i*2], part.sampler.mix[i]);
+      }
+
+      uint16_t dividers = 0;
+      for (int i = 0; i < 5; i++) {
+        const DrumPatternChannel& channel = part.drumSequencer.channel[i];
+        uint8_t* c = &buffer[17 + i*9];
+        for (int p = 0; p < 4; p++) {
+          writeUInt16(&c[p*2], channel.page[p]);
+        }
+        c[8] = channel.LastStep() | (channel.Enabled() ? 0x40 : 0x00);
+        dividers |= (uint16_t)channel.dividerIndex << (i*3);
+      }
+      if (part.drumSequencer.chainModeEnabled) dividers |= 0x8000;
+      writeUInt16(&buffer[62], dividers);
+    }
+
+    static void decodePart(const uint8_t* buffer, Part& part) {
+      uint16_t header = readUInt16(&buffer[0]);
+      part.pages = header & 0x07;
+      part.repeats = (header >> 3) & 0x3F;
+      part.chainTo = (int8_t)((header >> 9) & 0x1F) - 1;
+
+      part.tempo.bpm = buffer[2];
+      part.tempo.morphTargetBpm = buffer[3];
+      part.tempo.morphBars = buffer[4];
+      part.tempo.morphEnabled = buffer[5] != 0;
+
+      part.sampler.bank = buffer[6];
+      for (int i = 0; i < 5; i++) {
+        part.sampler.mix[i] = readUInt16(&buffer[7 + i*2]);
+      }
+
+      uint16_t dividers = readUInt16(&buffer[62]);
+      for (int i = 0; i < 5; i++) {
+        DrumPatternChannel& channel = part.drumSequencer.channel[i];
+        const uint8_t* c = &buffer[17 + i*9];
+        for (int p = 0; p < 4; p++) {
+          channel.page[p] = readUInt16(&c[p*2]);
+        }
+        channel.SetLastStep(c[8] & 0x3F);
+        channel.SetEnabled((c[8] & 0x40) != 0);
+        channel.SetDivider(indexToDivider((dividers >> (i*3)) & 0x07));
+      }
+      part.drumSequencer.chainModeEnabled = (dividers & 0x8000) != 0;
+    }
+
+    // parts equal to a reset part are left out of the record
+    static bool isEmptyPart(const Part& part) {
+      uint8_t encoded[SONG_PART_RECORD_SIZE];
+      uint8_t empty[SONG_PART_RECORD_SIZE];
+      Part emptyPart;
+      resetPart(emptyPart);
+      encodePart(part, encoded);
+      encodePart(emptyPart, empty);
+      return memcmp(encoded, empty, SONG_PART_RECORD_SIZE) == 0;
+    }
+
+    static uint8_t partMask(const Song& song) {
+      uint8_t mask = 0;
+      for (int i = 0; i < CHANNELS; i++) {
+        if (!isEmptyPart(song.parts[i])) mask |= (1 << i);
+      }
+      return mask;
+    }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef SongCache_h
+#define SongCache_h
+
+#include <Arduino.h>
+#include "shared.h"
+
+#define SONG_PREFETCH_DELAY 250 // ms the selected song must stay selected before it is prefetched
+
+/*
+* One decoded song (~550 bytes of SRAM on the Mega) exactly as it is stored
+* in the repository, so a hit is a plain copy: the song prefetched while the
+* user browses, or the one loaded last. Allocating for another song replaces
+* it. It must be invalidated when its song is saved or deleted.
+*/
+class SongCache {
+  private:
+    Song _song;
+    uint8_t _index = 0; // 0 => empty
+    unsigned long _hits = 0;
+    unsigned long _misses = 0;
+    unsigned long _prefetches = 0;
+
+  public:
+    bool Contains(int index) {
+      return _index != 0 && _index == index;
+    }
+
+    // counts a hit or a miss - use Contains() for lookups that aren't loads
+    Song* Find(int index) {
+      if (!Contains(index)) {
+        _misses++;
+        return nullptr;
+      }
+      _hits++;
+      return &_song;
+    }
+
+    // Returns the song to decode into, replacing the cached one.
+    // Invalidate(index) if the song could not be loaded into it.
+    Song& Allocate(int index, bool prefetch = false) {
+      _index = index;
+      if (prefetch) _prefetches++;
+      return _song;
+    }
+
+    void Invalidate(int index) {
+      if (Contains(index)) _index = 0;
+    }
+
+    void Clear() {
+      _index = 0;
+    }
+
+    void PrintStats() {
+      char s[100];
+      sprintf_P(s, PSTR("song cache => hits: %lu | misses: %lu | prefetched: %lu | cached:"), _hits, _misses, _prefetches);
+      Serial.print(s);
+      if (_index != 0) {
+        Serial.print(F(" "));
+        Serial.print(_index);
+      }
+      Serial.println();
+    }
+
+    void ResetStats() {
+      _hits = 0;
+      _misses = 0;
+      _prefetches = 0;
+    }
+};
+
+#endif
@@ -1,11 +1,24 @@
+//#define ENABLE_LOOP_PROFILER // per stage loop timing, dumped with the "stats" command
+
 #include "shared.h"
 #include "DebounceButton165.h"
 #include "kosmo-comm-master.h"
 #include "channel.h"
+#include "song-transport.h"
+#include "song-timeline.h"
 #include "AnalogMuxScanner.h"
+#include "pot-calibration.h"
 #include "integration-tests.h"
 #include "serial-song-parser.h"
+#include "command-table.h"
+#include "serial-line-reader.h"
 #include "song-repository-eeprom.h"
+#include "song-cache.h"
+#include "song-upload.h"
+#include "loop-profiler.h"
+#include "clock-pulse-queue.h"
+#include "led-display.h"
+#include "input-scanner-165.h"
 
 
 // input bit mask
@@ -24,7 +37,7 @@
 #define BLANK 10
 #define DASH 11
 
-#define SCAN_INTERVAL 50
+#define SCAN_INTERVAL 5 // a scan takes a few us, debouncing is done by the buttons
 #define MUX_SCAN_INTERVAL 10
 
 // CLOCK IN
@@ -57,6 +70,7 @@ unsigned long lastProgrammingLed = 0;
 unsigned long lastSongLoadingLed = 0;
 unsigned long lastSongLoading = 0;
 unsigned long lastSongBlink = 0;
+unsigned long lastSongSelect = 0;
 unsigned long lastClockInLed = 0;
 
 Song currentSong;
@@ -71,7 +85,7 @@ bool songLoadingLed = false;
 bool blinkSongNumber = false;
 
 bool clockInLed = false;
-volatile bool edgeDetected = false;
+ClockPulseQueue clockPulses;
 volatile bool reset = false;
 volatile bool hasPulse = false;
 
@@ -80,33 +94,49 @@ DebounceButton165 loadBtn(LOAD_BTN);
 DebounceButton165 nextSongBtn(NEXT_SONG_BTN);
 DebounceButton165 prevSongBtn(PREV_SONG_BTN);
 
+InputScanner165 inputs(INPUT_LOAD, INPUT_LATCH, INPUT_CLK, INPUT_DATA);
+LedDisplay display(LED_LATCH, LED_DATA, LED_CLOCK);
+#ifdef __AVR__
+ISR(TIMER3_COMPA_vect) {
+  display.Refresh();
+}
+#endif
+
 AnalogMuxScanner analogPotBank1(MUX_S0, MUX_S1, MUX_S2, A0, A1, A2, CHANNELS);
+PotCalibration potCalibration;
 
 Channel channels[CHANNELS];
+SongTransport transport(channels);
+SongTimeline songTimeline;
+unsigned long songPulse = 0; // clock pulses since the first part started
+int8_t seekEntry = -1; // timeline entry to jump to on the next downbeat
+unsigned long seekOffset = 0;
 
 SongRepositoryEEPROM songRepository;
+SongCache songCache;
+uint8_t prefetchedSongNumber = 0; // last song a prefetch was tried for
 
 SerialSongParser songParser(currentSong);
+Song uploadSong; // staging for binary uploads, becomes currentSong only once complete
+SongUploadReceiver songUpload(uploadSong);
 
 void setup() {
   Serial.begin(115200);
 
   // 74HC165
-  pinMode(INPUT_LOAD, OUTPUT);
-  pinMode(INPUT_CLK, OUTPUT);
-  pinMode(INPUT_LATCH, OUTPUT);
-  pinMode(INPUT_DATA, INPUT);
+  inputs.Begin();
 
   // 74HC595
-  pinMode(LED_CLOCK, OUTPUT);
-  pinMode(LED_LATCH, OUTPUT);
-  pinMode(LED_DATA, OUTPUT);
+  display.Begin();
 
   // // 74HC4051/analog mux
   analogPotBank1.onChange(onAnalogPotChangedHandler);
   analogPotBank1.setHysteresis(10);
-  analogPotBank1.setSamplesPerRead(5);
+  analogPotBank1.maskPot(2, 0); // always reads max
+  analogPotBank1.maskPot(4, 1); // always reads max
+  analogPotBank1.maskPot(6, 0); // unstable
   analogPotBank1.begin();
+  potCalibration.Load();
 
   // channels
   for(int i=0; i<CHANNELS; i++) {
@@ -126,9 +156,13 @@ void setup() {
 
   // song repository
     //SetupSongRepository();
+  songRepository.Init();
+  songRepository.OnSaveCompleted(onSongSaved);
+  songUpload.OnUploadCompleted(onSongUploaded);
+  songUpload.OnCanBegin(canBeginUploadSong);
 
 
-  Serial.println("Song Manager ready!");
+  Serial.println(F("Song Manager ready!"));
 
   //LoadSongAndUpdateChannels(1);
   songIsLoading = true;
@@ -138,27 +172,30 @@ void setup() {
 
 void LoadSongAndUpdateChannels(int index) {
   // load song from SD card, send values to channels 
-  Serial.print("Loading song: ");
-  Serial.println(index);  
-
-  Song prev = currentSong;
-  resetSong(currentSong);
+  LOG_INFO("Loading song: %d", index);
+
+  // a miss is decoded into the cache too, so currentSong is only touched by a good load
+  Song* song = songCache.Find(index);
+  if(!song) {
+    song = &songCache.Allocate(index);
+    if(!songRepository.LoadSong(index, *song)) {
+      songCache.Invalidate(index);
+      song = nullptr;
+    }
+  }
 
-  bool success;
-  currentSong = songRepository.LoadSong(index, success);
-  if(!success) {
-    char s[100];
-    sprintf(s, "Error loading song %d", index);
-    Serial.println(s);
-    currentSong = prev;
+  if(!song) {
+    LOG_ERROR("Error loading song %d", index);
     songIsLoading = false; 
     songLoadingLed = false;
     selectedSongNumber = currentSongNumber;
   } else {
+    currentSong = *song;
+    invalidateStagedPart();
     sendAllDrumSequencerParts(now, currentSong);
 
     applyCurrentSongToChannels();
-    Serial.println("###SONG LOADED###");
+    Serial.println(F("###SONG LOADED###"));
 
     songIsLoading = false; 
     songLoadingLed = false;
@@ -170,75 +207,130 @@ void LoadSongAndUpdateChannels(int index) {
   }  
 }
 
-bool partCompleted = false;
-int completedPart = -1;
-
-bool chainToNextPart = false;
-int nextPart = -1;
-
-
 void onPartCompleted(uint8_t channelNumber, int8_t chainToChannel) {
-  completedPart = channelNumber;
-  partCompleted = true;
-
-  if(chainToChannel == -1) {
+  if(!transport.PartCompleted(channelNumber, chainToChannel)) {
     stopClock();
-    Serial.println("no chain - stopping the clock");
-  } else if(chainToChannel < CHANNELS) {
-    nextPart = chainToChannel;
-    chainToNextPart = true;
+    LOG_INFO("no chain - stopping the clock");
   }
 }
 
 void onBeforePartCompleted(uint8_t channelNumber, int8_t chainToChannel) {
   if(chainToChannel >= 0 && chainToChannel < 8) {
-    sendPartIndex(now, chainToChannel);
-    setSlaveRegisters(now, currentSong.parts[chainToChannel]); 
+    // queued - sent from loop() so the clock path never waits on the bus
+    unsigned long deadline = now + PART_CHANGE_DEADLINE;
+    if(!commitStagedPart(now, chainToChannel, deadline)) {
+      sendPartIndex(now, chainToChannel, I2C_PRIORITY_HIGH, deadline);
+      setSlaveRegisters(now, currentSong.parts[chainToChannel], ALL, I2C_PRIORITY_HIGH, deadline); 
+    }
   }
 }
 
+// push the chain target's registers to the slaves' inactive bank
+void stageNextPart(uint8_t channelNumber) {
+  int8_t chainTo = (int8_t)channels[channelNumber].ChainTo();
+  if(chainTo >= 0 && chainTo < CHANNELS)
+    stagePart(now, chainTo, currentSong.parts[chainTo]);
+  else
+    invalidateStagedPart();
+}
+
 void onPartStarted(uint8_t channelNumber) {
   // if(currentChannel != channelNumber)
   //   setSlaveRegisters(now, currentSong.parts[channelNumber]);  
   // Serial.print("starting ");
   // channels[channelNumber].Print();
   currentChannel = channelNumber;
+  if(!songIsPlaying) {
+    songPulse = 0;
+    songTimeline.Build(channels, channelNumber);
+  }
   songIsPlaying = true;
+  stageNextPart(channelNumber);
 }
 
 void onPartStopped(uint8_t channelNumber) {
   //songIsPlaying = false;
 }
 
+// written in the background, see RunSave - refused while the previous save is still running
+bool saveSong(const Song& song, int index) {
+  if(!songRepository.BeginSave(song, index)) return false;
+  songCache.Invalidate(index); // the cached copy is stale from the moment the save starts
+  prefetchedSongNumber = 0;
+  return true;
+}
+
+void onSongSaved(int) {
+  Serial.println(F("###SONG SAVED###"));
+}
+
+void onSongUploaded(int slot, bool import) {
+  if(import) {
+    // saved straight from the staging song, the next one is only decoded after this save is encoded
+    saveSong(uploadSong, slot);
+    return;
+  }
+
+  currentSong = uploadSong;
+  invalidateStagedPart();
+  sendAllDrumSequencerParts(now, currentSong);
+  applyCurrentSongToChannels();
+  if(slot > 0) {
+    saveSong(currentSong, slot);
+    currentSongNumber = slot;
+    selectedSongNumber = slot;
+  }
+}
+
+// decode the selected song while the user is still browsing, so loading it is a copy
+// an imported song is only decoded once the previous one is written, so the loop never waits on a save
+bool canBeginUploadSong() {
+  return !songRepository.IsSaving();
+}
+
+void prefetchSelectedSong() {
+  if(programming || songIsLoading || songRepository.IsSaving()) return;
+  if(selectedSongNumber == currentSongNumber || selectedSongNumber == prefetchedSongNumber) return;
+  if(now - lastSongSelect < SONG_PREFETCH_DELAY) return;
+
+  prefetchedSongNumber = selectedSongNumber;
+  if(songCache.Contains(selectedSongNumber)) return;
+  if(!songRepository.LoadSong(selectedSongNumber, songCache.Allocate(selectedSongNumber, true)))
+    songCache.Invalidate(selectedSongNumber);
+}
+
 void onClockPulse() {
   lastClockPulse = now;  
-  edgeDetected = true;
+  clockPulses.push(micros());
   hasPulse = true;
 }
 
 void setCurrentSongDrumSequencerLastStep(int channel, int value) {
   for(int i=0; i<5; i++) {
-    currentSong.parts[channel].drumSequencer.channel[channel].lastStep = value;
+    currentSong.parts[channel].drumSequencer.channel[channel].SetLastStep(value);
   }
 }
 
 void onAnalogPotChangedHandler(int channel, int pot, uint16_t value) {
-  // ###handle bad pots###
-  if(channel == 2 && pot == 0) return;
-  if(channel == 4 && pot == 1) return;
-  if(channel == 6 && pot == 0) return;
+  // bad pots are masked in setup()
+  if(potCalibration.IsLearning()) {
+    potCalibration.Learn(channel, pot, value);
+    return;
+  }
 
+  int mapped = potCalibration.Map(channel, pot, value);
   if(pot==0) {
-    channels[channel].SetPageCountRaw(value);
+    channels[channel].SetPageCount(mapped);
     //setCurrentSongDrumSequencerLastStep(channel, channels[channel].PageCount()*16);
     currentSong.parts[channel].pages = channels[channel].PageCount();
   } else if(pot==1) {
-    channels[channel].SetRepeatsRaw(value);
+    channels[channel].SetRepeats(mapped);
     currentSong.parts[channel].repeats = channels[channel].Repeats();
   } else if(pot==2) {
-    channels[channel].SetChainToRaw(value);
+    channels[channel].SetChainTo(mapped);
     currentSong.parts[channel].chainTo = channels[channel].ChainTo();    
   }
+  updateTimeline();
 
   // // ###handle bad pots###
   // // channel 2,pot 0 always read max value so we set it to 1 page to make it usefull
@@ -259,24 +351,8 @@ void onAnalogPotChangedHandler(int channel, int pot, uint16_t value) {
 
 }
 
-uint8_t read165byte() {
-  uint8_t value = 0;
-  for (int i = 0; i < 8; i++) {
-    digitalWrite(INPUT_CLK, LOW);      // prepare falling edge
-    if (digitalRead(INPUT_DATA)) {
-      value |= (1 << i);               // store bit in LSB first
-    }
-    digitalWrite(INPUT_CLK, HIGH);     // shift register updates here
-  }
-  return value;
-}
-
-void write595byte(uint8_t data, uint8_t bitOrder = LSBFIRST) {
-    shiftOut(LED_DATA, LED_CLOCK, bitOrder, data);
-}
-
 void scanOperationsBoard() {
-  uint8_t incoming = read165byte();
+  uint8_t incoming = inputs.Byte(0);
   //printByteln(incoming);
   if(incoming == 0xFF) return;
 
@@ -291,8 +367,8 @@ void scanOperationsBoard() {
 void scanChannelBoards() {
   uint8_t incoming = 0;
   for(int i=0; i<CHANNELS; i++) {
-    if(i % 8 == 0) {// only read 1 165 pr 8 channels
-      incoming = read165byte();
+    if(i % 8 == 0) {// 1 165 pr 8 channels
+      incoming = inputs.Byte(1 + i / 8);
       //printByteln(incoming);
       if(incoming == 0xFF) return;
     }
@@ -300,19 +376,23 @@ void scanChannelBoards() {
     channels[i].Button()->update(incoming, now);
 
     if(channels[i].Button()->wasPressed()) {
-      Serial.print("Button pressed: ");
-      Serial.println(i);
+      LOG_DEBUG("Button pressed: %d", i);
       if(programming) {
         bool success = false;
         while(!getSlaveRegisters(now, success));
         if(success) {
           currentSong.parts[i].tempo = sharedTempoRegisters;
-          currentSong.parts[i].drumSequencer = sharedDrumSequencerRegisters;
+          fromDrumSequencerRegisters(sharedDrumSequencerRegisters, currentSong.parts[i].drumSequencer);
           currentSong.parts[i].sampler = sharedSamplerRegisters;
           currentSong.parts[i].repeats = channels[i].Repeats();
           currentSong.parts[i].chainTo = channels[i].ChainTo();
           currentSong.parts[i].pages = channels[i].PageCount();
           //channels[i].SetLastStep(getPartLastStep(currentSong.parts[i]));
+          if(i == stagedPart) {
+            // the slaves' inactive bank holds the part as it was - stage the edited one
+            invalidateStagedPart();
+            if(songIsPlaying) stageNextPart(currentChannel);
+          }
         }
       } else {
         if(channels[currentChannel].IsStarted()) {
@@ -321,6 +401,8 @@ void scanChannelBoards() {
           if(chainTo != -1 && channels[i].ChainTo() == -1) {
             channels[i].SetChainTo(chainTo);
           }
+          stageNextPart(currentChannel);
+          updateTimeline();
         } else {
           setSlaveRegisters(now, currentSong.parts[i]);
           sendPartIndex(now, i);
@@ -334,24 +416,14 @@ void scanChannelBoards() {
 }
 
 void scanAnalogInputMux() {
-  if(!programming) return;
+  if(!programming && !potCalibration.IsLearning()) return;
   analogPotBank1.scan(now);
 }
 
 void scanInputs() {
-  digitalWrite(INPUT_LOAD, LOW);
-  delayMicroseconds(5);
-  digitalWrite(INPUT_LOAD, HIGH);
-  delayMicroseconds(5);
-  digitalWrite(INPUT_CLK, HIGH);
-  digitalWrite(INPUT_LATCH, LOW);
-
-  // read data here
+  inputs.Scan();
   scanOperationsBoard();
   scanChannelBoards();
-
-  digitalWrite(INPUT_LATCH, HIGH);
-
 }
 
 
@@ -406,7 +478,7 @@ int getDigit(int number, int position) {
 }
 
 
-void updateOperationsBoardDigit(int digit, int songNumber) {
+void updateOperationsBoardDigit(uint8_t* row, int digit, int songNumber) {
 
   /*
   * 1st 595:          2nd 595:
@@ -425,6 +497,8 @@ void updateOperationsBoardDigit(int digit, int songNumber) {
 
   int digitVal = getDigit(songNumber, index);
   data[0] = (blinkSongNumber) ? 0x00 : digitToSegment[digitVal];
+  if(songRepository.IsSaving())
+    data[0] = digitToSegment[digitVal] | 0x01; // save progress in percent, dp lit and no blinking
   data[1] = digitEnable[index];
 
   if(programmingLed)  // red led blinking while loading
@@ -447,12 +521,11 @@ void updateOperationsBoardDigit(int digit, int songNumber) {
     data[1] |= 0x04;
   
 
-  write595byte(data[1]);
-  write595byte(data[0]);
-
+  row[0] = LedDisplay::Reverse(data[1]); // the ops board is wired LSB first
+  row[1] = LedDisplay::Reverse(data[0]);
 }
 
-void updateChannelDigit(int channel, int digit) {
+void updateChannelDigit(uint8_t* row, int channel, int digit) {
   /*
   * 1st 595:                                        2nd 595:
   * QA => DIG_0 enable (LEDS)                       QA => SEG_A
@@ -499,8 +572,8 @@ void updateChannelDigit(int channel, int digit) {
       segmentData = (chainTo==-1) ? digitToSegment28[11] : digitToSegment28[(chainTo+1) / 10];
       break;          
   }
-  write595byte(digitData, MSBFIRST);
-  write595byte(segmentData, MSBFIRST);
+  row[0] = digitData;
+  row[1] = segmentData;
 }
 
 void updateChannelProgramming(int channel, int digit) {
@@ -515,13 +588,52 @@ void updateChannelProgramming(int channel, int digit) {
 }
 
 
-const int DIGITS = 5;
-void updateUI() {
-
-  for(int digit=0; digit<DIGITS; digit++) {
+// everything the display shows - the frame is only rebuilt when this changes
+struct UiState {
+  uint8_t songNumber;
+  bool saving;
+  bool blinkSongNumber;
+  bool programming;
+  bool programmingLed;
+  bool songIsLoading;
+  bool songLoadingLed;
+  bool clockInLed;
+  uint8_t pageLeds[CHANNELS];
+  uint8_t repeats[CHANNELS];
+  int8_t chainTo[CHANNELS];
+};
+UiState uiState;
+bool uiStateValid = false;
+
+void captureUiState(UiState& state) {
+  memset(&state, 0, sizeof(UiState));
+  state.saving = songRepository.IsSaving();
+  state.songNumber = state.saving ? songRepository.SaveProgress() : selectedSongNumber;
+  state.blinkSongNumber = blinkSongNumber;
+  state.programming = programming;
+  state.programmingLed = programmingLed;
+  state.songIsLoading = songIsLoading;
+  state.songLoadingLed = songLoadingLed;
+  state.clockInLed = clockInLed;
+  for(int channel=0; channel<CHANNELS; channel++) {
+    for(int i=0; i<4; i++)
+      state.pageLeds[channel] |= channels[channel].PageLedState(i) << i;
+    state.repeats[channel] = channels[channel].IsStarted() ? channels[channel].RemainingRepeats() : channels[channel].Repeats();
+    state.chainTo[channel] = channels[channel].ChainTo();
+  }
+}
 
-    digitalWrite(LED_LATCH, LOW);
-    updateOperationsBoardDigit(digit, selectedSongNumber);
+void updateUI() {
+  if(display.IsSwapPending()) return; // the back buffer is the frame about to be shown
+  UiState state;
+  captureUiState(state);
+  if(uiStateValid && memcmp(&state, &uiState, sizeof(UiState)) == 0) return;
+  uiState = state;
+  uiStateValid = true;
+
+  for(int digit=0; digit<DISPLAY_DIGITS; digit++) {
+    uint8_t* row = display.Row(digit);
+    updateOperationsBoardDigit(row, digit, state.songNumber);
     for(int channel=0; channel<CHANNELS; channel++) {
       // if(programming)
       //   updateChannelProgramming(channel, digit);
@@ -531,16 +643,32 @@ void updateUI() {
       // sprintf(s, "ch%d: pages=%d  repeats=%d  chain-to=%d", channel, channels[channel].PageCount(), channels[channel].Repeats(), channels[channel].ChainTo());
       // Serial.println(s);
 
-      updateChannelDigit(channel, digit);
+      updateChannelDigit(row + 2 + 2 * channel, channel, digit);
+    }
+  }
+  display.Swap();
+}
+
+// filtered pot values, masked pots marked with *
+void printPots() {
+  char s[30];
+  for(int channel=0; channel<CHANNELS; channel++) {
+    Serial.print(F("ch"));
+    Serial.print(channel);
+    Serial.print(F(" =>"));
+    for(int pot=0; pot<3; pot++) {
+      sprintf_P(s, PSTR(" %4u%c(%u..%u)"), analogPotBank1.value(channel, pot), analogPotBank1.isMasked(channel, pot) ? '*' : ' ',
+              potCalibration.Min(channel, pot), potCalibration.Max(channel, pot));
+      Serial.print(s);
     }
-    digitalWrite(LED_LATCH, HIGH);
+    Serial.println();
   }
 }
 
-uint8_t getPartLastStep(Part part) {
+uint8_t getPartLastStep(const Part& part) {
   uint8_t lastStep = 0;
   for(int i=0; i<5; i++) {
-    lastStep = max(lastStep, part.drumSequencer.channel[i].lastStep);
+    lastStep = max(lastStep, part.drumSequencer.channel[i].LastStep());
   }
   return lastStep;
 }
@@ -556,21 +684,248 @@ void applyCurrentSongToChannels() {
   for(int i=0; i<CHANNELS; i++) {
     applyCurrentSongToChannel(i);
   }
+  updateTimeline();
+}
+
+// a playing song keeps the part it was started from
+void updateTimeline() {
+  songTimeline.Build(channels, songIsPlaying ? songTimeline.FirstPart() : firstSongPart(currentSong));
+}
+
+
+// jump to a position (a downbeat) of the song - on the next downbeat when playing, else right away and the clock is started
+bool seekTo(unsigned long pulse) {
+  unsigned long offset = 0;
+  int8_t entry = songTimeline.Locate(pulse, offset);
+  if(entry < 0) {
+    LOG_WARN("Position is past the end of the song");
+    return false;
+  }
+
+  // the slaves get the part now, the drum sequencer moves to the step on its next downbeat
+  uint8_t part = songTimeline.Entry(entry).part;
+  invalidateStagedPart();
+  setSlaveRegisters(now, currentSong.parts[part], ALL, I2C_PRIORITY_HIGH);
+  sendPartPosition(now, part, offset / 6);
+
+  seekEntry = entry;
+  seekOffset = offset;
+  if(!songIsPlaying) {
+    applySeek();
+    startClock();
+  }
+  return true;
 }
 
+bool seekToBar(unsigned long bar) {
+  if(bar < 1) return false;
+  return seekTo((bar - 1) * TIMELINE_PULSES_PR_BAR);
+}
+
+// the start of the next part, or back to the start of the playing part - the previous one when still in its first bar
+void seekToPart(int direction) {
+  unsigned long offset = 0;
+  int8_t entry = songTimeline.Locate(songPulse, offset);
+  if(entry < 0) return;
+  if(direction > 0) entry = songTimeline.NextEntry(entry);
+  else if(offset < TIMELINE_PULSES_PR_BAR && entry > 0) entry--;
+  if(entry >= 0) seekTo(songTimeline.Entry(entry).start);
+}
+
+void applySeek() {
+  const TimelineEntry& entry = songTimeline.Entry(seekEntry);
+  songIsPlaying = true; // a seek doesn't restart the song position, see onPartStarted
+  transport.StartAt(entry.part, seekOffset / 6);
+  songPulse = entry.start + seekOffset;
+  seekEntry = -1;
+
+  LOG_INFO("Seek => bar %lu | part %d | step %lu", songPulse / TIMELINE_PULSES_PR_BAR + 1, entry.part, seekOffset / 6);
+}
 
-int ppqnCounter = 0;
 void triggerClockPulse() {
-  ppqnCounter = (ppqnCounter + 1) % 24;
-  for(int i=0; i<CHANNELS; i++)
-    channels[i].Pulse(ppqnCounter);
-  if(ppqnCounter == 0) {
+  if(songIsPlaying) songPulse++;
+  transport.Pulse(); // also stops completed parts and starts chained parts on the downbeat
+  if(transport.PpqnCounter() == 0 && seekEntry >= 0)
+    applySeek();
+  if(transport.PpqnCounter() == 0) {
     clockInLed = true;
     lastClockInLed = now;
   }
 }
 
+// ---------------------------------------------------------------- serial commands
+
+void commandLoad(const int* args) {
+  LoadSongAndUpdateChannels(args[0]);
+}
+
+void commandSave(const int*) {
+  if(!saveSong(currentSong, currentSongNumber)) return;
+  currentChannel = 0;
+  transport.Reset();
+}
+
+void commandUpload(const int*) {
+  songUpload.Begin(now);
+}
+
+void commandImport(const int*) {
+  songUpload.Begin(now, true);
+}
+
+void commandExport(const int*) {
+  Serial.println(F("###EXPORT###"));
+  uint8_t exported = songRepository.ExportSongs();
+  Serial.print(F("###EXPORT END "));
+  Serial.print(exported);
+  Serial.println(F("###"));
+}
+
+void commandSongs(const int*) {
+  songRepository.PrintDirectory();
+}
+
+void commandDelete(const int* args) {
+  if(songRepository.DeleteSong(args[0])) {
+    songCache.Invalidate(args[0]);
+    prefetchedSongNumber = 0;
+    Serial.println(F("###SONG DELETED###"));
+  }
+}
+
+void commandPrint(const int*) {
+  printSong(currentSong);
+}
+
+void commandSeek(const int* args) {
+  if(args[0] > 0) seekToBar(args[0]);
+}
+
+void commandPots(const int*) {
+  printPots();
+}
+
+void commandCalibrate(const int*) {
+  potCalibration.Begin();
+  Serial.println(F("Calibrating - turn every pot end to end, then 'calibrate end'"));
+}
+
+void commandCalibrateEnd(const int*) {
+  songRepository.FinishSave(); // the calibration is written blocking, not between save writes
+  Serial.print(F("Pots calibrated: "));
+  Serial.println(potCalibration.End());
+}
+
+void commandCalibrateCancel(const int*) {
+  potCalibration.Cancel();
+}
+
+void commandTimeline(const int*) {
+  songTimeline.Print(songPulse);
+}
+
+void commandStats(const int*) {
+  printLoopProfile();
+  clockPulses.printStats();
+  i2cScheduler.printStats();
+  printDeltaSyncStats();
+  songCache.PrintStats();
+  display.PrintStats();
+  logger.PrintStats();
+  Serial.print(F("serial => lines dropped: "));
+  Serial.println(serialLines.Dropped());
+}
+
+void commandStatsReset(const int*) {
+  resetLoopProfile();
+  clockPulses.resetStats();
+  songCache.ResetStats();
+  logger.ResetStats();
+}
+
+void commandStart(const int* args) {
+  int partToStart = args[0];
+  if(partToStart < 0 || partToStart >= CHANNELS) return;
+  setSlaveRegisters(now, currentSong.parts[partToStart]);
+  sendPartIndex(now, partToStart);
+  i2cScheduler.flush();
+  delay(100);
+  channels[partToStart].Start();
+  startClock();
+}
+
+void commandStop(const int*) {
+  stopClock();
+}
+
+void commandTest(const int* args) {
+  runIntegrationTest(args[0], args[1], currentSong);
+}
+
+void commandInit(const int*) {
+  resetSong(currentSong);
+  applyCurrentSongToChannels();
+  Serial.println(F("Song initialized"));
+}
+
+void commandApply(const int*) {
+  applyCurrentSongToChannels();
+  int index = firstSongPart(currentSong);
+  if(index >= 0 && index < CHANNELS) {
+    setSlaveRegisters(now, currentSong.parts[index]); 
+  }
+  Serial.print(F("Song loaded from serial and modules loaded from part: "));
+  Serial.println(index);
+}
+
+void commandPrintChannel(const int* args) {
+  if(args[0] >= 0 && args[0] < CHANNELS) {
+    channels[args[0]].Print();
+  }
+}
+
+// sorted by name (ASCII), see command-table.h - anything else is a song command
+constexpr Command serialCommands[] PROGMEM = {
+  {"?", COMMAND_OPTIONAL_INT, commandPrintChannel},
+  {"apply", COMMAND_NO_ARGS, commandApply},
+  {"calibrate", COMMAND_NO_ARGS, commandCalibrate},
+  {"calibrate cancel", COMMAND_NO_ARGS, commandCalibrateCancel},
+  {"calibrate end", COMMAND_NO_ARGS, commandCalibrateEnd},
+  {"delete", COMMAND_INT, commandDelete},
+  {"export", COMMAND_NO_ARGS, commandExport},
+  {"import", COMMAND_NO_ARGS, commandImport},
+  {"init", COMMAND_NO_ARGS, commandInit},
+  {"load", COMMAND_INT, commandLoad},
+  {"pots", COMMAND_NO_ARGS, commandPots},
+  {"print", COMMAND_NO_ARGS, commandPrint},
+  {"save", COMMAND_NO_ARGS, commandSave},
+  {"seek", COMMAND_INT, commandSeek},
+  {"songs", COMMAND_NO_ARGS, commandSongs},
+  {"start", COMMAND_INT, commandStart},
+  {"stats", COMMAND_NO_ARGS, commandStats},
+  {"stats reset", COMMAND_NO_ARGS, commandStatsReset},
+  {"stop", COMMAND_NO_ARGS, commandStop},
+  {"test", COMMAND_INT_INT, commandTest},
+  {"timeline", COMMAND_NO_ARGS, commandTimeline},
+  {"upload", COMMAND_NO_ARGS, commandUpload},
+};
+static_assert(tableSorted(serialCommands), "serialCommands must be sorted by name");
+
+void runSongCommand(const char* command) {
+  SlaveEnum target;
+  int index = songParser.parseCommand(command, target);
+  if(index >= 0 && index < CHANNELS) {
+    applyCurrentSongToChannel(index);
+    updateTimeline();
+    if(index == stagedPart) invalidateStagedPart();
+  }
+  // if(index >= 0 && index < CHANNELS && target >= 0 && target < 100) {
+  //   setSlaveRegisters(now, currentSong.parts[index], target); 
+  // }      
+}
+
 void loop() {
+  PROFILE_LOOP_BEGIN();
   now = millis();
  
   // handle reset
@@ -581,60 +936,68 @@ void loop() {
 
   if(reset) {
     reset = false;
-    ppqnCounter = 0;
+    transport.Reset();
+    clockPulses.clear();
     songIsPlaying = false;
+    songPulse = 0;
+    seekEntry = -1;
     for(int i=0; i<CHANNELS; i++) {
       channels[i].Reset();
     }
     currentChannel = 0;
-    Serial.println("reset!");
+    invalidateSlaveShadows(); // slaves may have been power cycled while the clock was stopped
+    invalidateStagedPart();
+    LOG_INFO("reset!");
   }
 
-  // handle clock in
-  if(edgeDetected) {
-    edgeDetected = false;
+  // handle clock in - every queued pulse is played so none are merged when a pass runs long
+  unsigned long pulseTime;
+  while(clockPulses.pop(pulseTime)) {
     if(!songIsPlaying)
       channels[currentChannel].Start();
     triggerClockPulse();
   }
-
-  if(partCompleted && ppqnCounter == 0 && completedPart >= 0 and completedPart < CHANNELS) {
-    partCompleted = false;
-    // char s[100];
-    // sprintf(s, "part %d ended - ", completedPart);
-    // Serial.print(s);    
-    channels[completedPart].Stop();
-  }
-
-  if(chainToNextPart && ppqnCounter == 0 && nextPart >= 0 && nextPart < CHANNELS) {
-    chainToNextPart = false;
-    // Serial.print("chaining to part ");      
-    // Serial.println(nextPart);
-    channels[nextPart].Start();
-  }
+  if(drumPartsPending) sendAllDrumSequencerParts(now, currentSong);
+  i2cScheduler.run(now);
+  songRepository.RunSave();
+  PROFILE_MARK(STAGE_CLOCK);
 
   if (now > (lastInputScan + SCAN_INTERVAL)) {
     lastInputScan = now;
     scanInputs();
   }
+  PROFILE_MARK(STAGE_INPUTS);
 
   for(int i=0; i<CHANNELS; i++)
     channels[i].Run(now);
+  PROFILE_MARK(STAGE_CHANNELS);
 
   updateUI();    
+  display.Run();
+  PROFILE_MARK(STAGE_UI);
 
   scanAnalogInputMux();
+  PROFILE_MARK(STAGE_MUX);
 
  
+// SEEK - hold PREV and press NEXT to jump to the next part, hold NEXT and press PREV to jump back
+  if(!programming && songIsPlaying && nextSongBtn.isDown() && prevSongBtn.isDown()) {
+    bool forward = nextSongBtn.wasPressed();
+    bool back = prevSongBtn.wasPressed();
+    if(forward || back) {
+      selectedSongNumber = currentSongNumber; // undo the selection made by the held button
+      seekToPart(forward ? 1 : -1);
+    }
+  }
 // NEXT SONG INDEX
   if(!programming && nextSongBtn.wasPressed() && !prevSongBtn.isDown()) {
     if(selectedSongNumber < MAX_SONGS-2)
       selectedSongNumber++;
     else
       selectedSongNumber=1;
+    lastSongSelect = now;
 
-    Serial.print("Selected song: ");
-    Serial.println(selectedSongNumber);
+    LOG_INFO("Selected song: %d", selectedSongNumber);
   }
 // PREV SONG INDEX
   if(!programming && prevSongBtn.wasPressed() && !nextSongBtn.isDown()) {
@@ -642,10 +1005,11 @@ void loop() {
       selectedSongNumber--;
     else
       selectedSongNumber = MAX_SONGS;
+    lastSongSelect = now;
 
-    Serial.print("Selected song: ");
-    Serial.println(selectedSongNumber);    
+    LOG_INFO("Selected song: %d", selectedSongNumber);
   }
+  prefetchSelectedSong();
 // LOAD SONG
   if(!programming && loadBtn.wasPressed()) { //&& selectedSongNumber != currentSongNumber) {
     songIsLoading = true;
@@ -666,28 +1030,28 @@ void loop() {
       programmingLed = false;
       resetTempoRegisters(sharedTempoRegisters);
       resetDrumSequencerRegisters(sharedDrumSequencerRegisters);      
-      Serial.println("programming cancelled - song not saved");
+      LOG_INFO("programming cancelled - song not saved");
   }
   if(!songIsLoading && programBtn.wasPressed()) { 
 // START PROGRAMMING
     if(!programming) {                      
       programming = true;
-      Serial.println("programming...");
+      LOG_INFO("programming...");
     } else { 
 // END PROGRAMMING                          
-      songRepository.SaveSong(currentSong, selectedSongNumber);
-      currentChannel = 0;
-      ppqnCounter = 0;
-
-      Serial.println("###SONG SAVED###");
-
-      //PeekSong(selectedSongNumber);
-
-      programming = false;
-      programmingLed = false;
-      resetTempoRegisters(sharedTempoRegisters);
-      resetDrumSequencerRegisters(sharedDrumSequencerRegisters);      
-      Serial.println("programming end");
+      // not saved (the last song is still being written, or no room) - programming goes on
+      if(saveSong(currentSong, selectedSongNumber)) {
+        currentChannel = 0;
+        transport.Reset();
+
+        //PeekSong(selectedSongNumber);
+
+        programming = false;
+        programmingLed = false;
+        resetTempoRegisters(sharedTempoRegisters);
+        resetDrumSequencerRegisters(sharedDrumSequencerRegisters);      
+        LOG_INFO("programming end");
+      }
     }
   }  
 
@@ -712,77 +1076,21 @@ void loop() {
   if(now >(lastClockInLed + LED_SHORT_PULSE)) {
     clockInLed = false;
   }
+  PROFILE_MARK(STAGE_BUTTONS);
 
 
 
 
 
-  if(Serial.available()) {
-    String command = Serial.readStringUntil('\n');
-    command.trim();
-    if(command.indexOf("load ")==0) {
-      int songToLoad=-1;
-      int size=0;
-      String* parts = splitString(command, ' ', size);
-      if(size == 2 && tryGetInt(parts[1], songToLoad)) {
-        LoadSongAndUpdateChannels(songToLoad);
-      }
-    } else if(command=="save") {
-      songRepository.SaveSong(currentSong, currentSongNumber);
-      currentChannel = 0;
-      ppqnCounter = 0;
-      Serial.println("###SONG SAVED###");      
-    } else if(command=="print") {
-      printSong(currentSong);
-    } else if(command.indexOf("start ")==0) {
-      int partToStart=-1;
-      int size=0;
-      String* parts = splitString(command, ' ', size);
-      if(size == 2 && tryGetInt(parts[1], partToStart) && partToStart >= 0 && partToStart < CHANNELS) {
-        setSlaveRegisters(now, currentSong.parts[partToStart]);
-        sendPartIndex(now, partToStart);
-        delay(100);
-        channels[partToStart].Start();
-        startClock();  
-      }      
-    } else if(command=="stop") {
-      stopClock();
-    } else if (command.indexOf("test ")==0) {
-      int size=0;
-      String* parts = splitString(command, ' ', size);
-      int testIndex = -1;
-      int partIndex = -1;
-      if(size==3 & tryGetInt(parts[1], testIndex) && tryGetInt(parts[2], partIndex)) {
-        runIntegrationTest(testIndex, partIndex, currentSong);
-      }
-    } else if(command=="init") {
-      resetSong(currentSong);
-      applyCurrentSongToChannels();
-      Serial.println("Song initialized");
-    } else if (command=="apply") {
-      applyCurrentSongToChannels();
-      int index = firstSongPart(currentSong);
-      if(index >= 0 && index < CHANNELS) {
-        setSlaveRegisters(now, currentSong.parts[index]); 
-      }
-      Serial.print("Song loaded from serial and modules loaded from part: ");
-      Serial.println(index);
-    } else if (command.indexOf('?') == 0) {
-      String number = command.substring(1);
-      int index=number.toInt();
-      if(index >= 0 && index < CHANNELS) {
-        channels[index].Print();
-      }
-    } else {
-      SlaveEnum target;
-      int index = songParser.parseCommand(command, target);    
-      if(index >= 0 && index < CHANNELS) {
-        applyCurrentSongToChannel(index);
-      }    
-      // if(index >= 0 && index < CHANNELS && target >= 0 && target < 100) {
-      //   setSlaveRegisters(now, currentSong.parts[index], target); 
-      // }      
+  if(songUpload.IsActive()) {
+    songUpload.Run(now);
+  } else if(serialLines.Read()) {
+    if(!runCommand(serialCommands, serialLines.Line())) {
+      runSongCommand(serialLines.Line());
     }
   } 
+  logger.Flush();
+  PROFILE_MARK(STAGE_SERIAL);
+  PROFILE_LOOP_END();
 }
 
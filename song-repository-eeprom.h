@@ -4,76 +4,553 @@
 #include <Arduino.h>
 #include <EEPROM.h>
 #include "shared.h"
-#include "song-serializer.h"
+#include "song-binary-format.h"
 
-#define SONG_SIZE 2048
+/*
+* EEPROM layout
+*
+* directory header (at address 0):
+*   0..1  magic 'K' 'D'
+*   2     directory version
+*   3     number of slots (MAX_SONGS)
+*
+* journal (ring of SONG_JOURNAL_SLOTS records, the newest sequence number wins):
+*   0     sequence number
+*   1     song slot
+*   2..9  the directory entry being committed
+*   10..11 crc16 of bytes 0..9
+*
+* directory: one 8 byte entry pr song slot, slot 1 first:
+*   0..1  record offset, 0xFFFF => empty slot (erased EEPROM reads as empty)
+*   2..3  record length
+*   4..5  crc16 of the record
+*   6..7  offset of the previous version of the record (spare), 0xFFFF => none
+*
+* records (after the directory):
+*   variable length song records (see song-binary-format.h)
+*
+* the last EEPROM_RESERVED_SIZE bytes are left alone (pot calibration).
+*
+* A save writes the new record next to the current one - preferably over the
+* spare, which holds an older version of the same song, so with update
+* semantics only the changed bytes are written - then journals the new
+* directory entry and finally writes the entry. The current version is never
+* touched, so an interrupted save leaves it loadable, and Init() replays a
+* journaled entry whose directory write was cut off. Spares are only soft
+* reserved: other songs may take their space when the EEPROM fills up.
+*
+* Records are allocated in SONG_BLOCK_SIZE blocks from a bitmap in RAM of
+* the blocks current records use, built by Init() and again after every
+* directory change, so finding room is a scan of the bitmap.
+*
+* Saves run in the background: BeginSave() encodes the record into RAM and
+* RunSave(), called every loop pass, starts at most one byte write and
+* never waits for the EEPROM, so the clock and the UI keep running. One save
+* runs at a time, BeginSave() refuses another until it is written.
+*/
 
-int address = 0;
+#define SONG_DIR_MAGIC_0 'K'
+#define SONG_DIR_MAGIC_1 'D'
+#define SONG_DIR_VERSION 2
+#define SONG_DIR_HEADER_SIZE 4
+#define SONG_JOURNAL_SLOTS 4
+#define SONG_JOURNAL_RECORD_SIZE 12
+#define SONG_JOURNAL_START SONG_DIR_HEADER_SIZE
+#define SONG_DIR_ENTRY_SIZE 8
+#define SONG_DIR_ENTRIES_START (SONG_JOURNAL_START + SONG_JOURNAL_SLOTS * SONG_JOURNAL_RECORD_SIZE)
+#define SONG_DIR_SIZE (SONG_DIR_ENTRIES_START + MAX_SONGS * SONG_DIR_ENTRY_SIZE)
+#define SONG_DIR_EMPTY 0xFFFF
+#define SONG_DATA_END ((uint16_t)(EEPROM.length() - EEPROM_RESERVED_SIZE))
+#define SAVE_SCAN_PER_PASS 32 // bytes compared pr RunSave() call
+#define SONG_BLOCK_SIZE 8 // allocation unit, records start on a block
+#define SONG_BLOCK_COUNT ((E2END + 1) / SONG_BLOCK_SIZE)
 
-void writeLineToEEPROM(const String& line) {
-  Serial.print(address);
-  Serial.print(":");
-  Serial.println(line);
-  for (int i = 0; i < line.length(); i++) {
-    EEPROM.write(address++, line[i]);
-  }
-  EEPROM.write(address++, '\n'); // Add newline character
-}
+typedef void (*SaveCompleted)(int); // song index
+
+struct SongDirectoryEntry {
+  uint16_t offset;
+  uint16_t length;
+  uint16_t crc;
+  uint16_t spare;
+};
 
 class SongRepositoryEEPROM {
   private:
-    int calculateAddress(int index) {
-      if(index < 1) return -1;
-      // first song is index 1 => we want to start at address 0
-      return (index-1) * SONG_SIZE; // Assume each song takes 512 bytes, adjust if needed
+    int8_t _journalSlot = -1; // newest journal record, -1 => not scanned yet
+    uint8_t _journalSequence = 0;
+    uint8_t _usedBlocks[SONG_BLOCK_COUNT / 8]; // blocks holding the directory, a current record or the reserved top
+
+    // background save
+    uint8_t _record[SONG_RECORD_MAX_SIZE];
+    uint8_t _commit[SONG_JOURNAL_RECORD_SIZE + SONG_DIR_ENTRY_SIZE]; // journal record + directory entry
+    uint8_t _saveIndex = 0; // 0 => no save in progress
+    uint16_t _saveOffset = 0;
+    uint16_t _saveLength = 0;
+    uint8_t _saveSegment = 0;
+    uint16_t _savePosition = 0;
+    uint16_t _saveDone = 0;
+    uint16_t _saveWritten = 0;
+    SaveCompleted _onSaveCompleted = nullptr;
+
+    int entryAddress(int index) {
+      if(index < 1 || index > MAX_SONGS) return -1;
+      return SONG_DIR_ENTRIES_START + (index-1) * SONG_DIR_ENTRY_SIZE;
+    }
+
+    // compare before write - unchanged bytes cost neither time nor endurance
+    uint16_t updateBytes(int address, const uint8_t* buffer, size_t length) {
+      uint16_t written = 0;
+      for (size_t i = 0; i < length; i++) {
+        if (EEPROM.read(address + i) == buffer[i]) continue;
+        EEPROM.write(address + i, buffer[i]);
+        written++;
+      }
+      return written;
+    }
+
+    void readBytes(int address, uint8_t* buffer, size_t length) {
+      for (size_t i = 0; i < length; i++) {
+        buffer[i] = EEPROM.read(address + i);
+      }
+    }
+
+    bool hasDirectory() {
+      return EEPROM.read(0) == SONG_DIR_MAGIC_0 && EEPROM.read(1) == SONG_DIR_MAGIC_1
+          && EEPROM.read(2) == SONG_DIR_VERSION && EEPROM.read(3) == MAX_SONGS;
+    }
+
+    // one-time initialization of a blank (or foreign) EEPROM
+    void formatDirectory() {
+      Serial.println(F("Formatting song directory"));
+      for (int address = SONG_JOURNAL_START; address < SONG_DIR_SIZE; address++) {
+        EEPROM.update(address, 0xFF);
+      }
+      uint8_t header[SONG_DIR_HEADER_SIZE] = {SONG_DIR_MAGIC_0, SONG_DIR_MAGIC_1, SONG_DIR_VERSION, MAX_SONGS};
+      updateBytes(0, header, SONG_DIR_HEADER_SIZE);
+      _journalSlot = SONG_JOURNAL_SLOTS - 1;
+      _journalSequence = 0;
+      buildBlockMap();
+    }
+
+    void encodeEntry(const SongDirectoryEntry& entry, uint8_t* buffer) {
+      writeUInt16(&buffer[0], entry.offset);
+      writeUInt16(&buffer[2], entry.length);
+      writeUInt16(&buffer[4], entry.crc);
+      writeUInt16(&buffer[6], entry.spare);
+    }
+
+    void decodeEntry(const uint8_t* buffer, SongDirectoryEntry& entry) {
+      entry.offset = readUInt16(&buffer[0]);
+      entry.length = readUInt16(&buffer[2]);
+      entry.crc = readUInt16(&buffer[4]);
+      entry.spare = readUInt16(&buffer[6]);
+    }
+
+    bool isValidRecord(uint16_t offset, uint16_t length) {
+      return offset != SONG_DIR_EMPTY
+          && offset >= SONG_DIR_SIZE
+          && length >= SONG_HEADER_SIZE
+          && (unsigned long)offset + length <= SONG_DATA_END;
+    }
+
+    // returns false for an empty slot, the entry is still filled in (spare included)
+    bool readEntry(int index, SongDirectoryEntry& entry) {
+      int address = entryAddress(index);
+      if(address < 0) return false;
+      uint8_t buffer[SONG_DIR_ENTRY_SIZE];
+      readBytes(address, buffer, SONG_DIR_ENTRY_SIZE);
+      decodeEntry(buffer, entry);
+      return isValidRecord(entry.offset, entry.length);
+    }
+
+    void writeEntry(int index, const SongDirectoryEntry& entry) {
+      uint8_t buffer[SONG_DIR_ENTRY_SIZE];
+      encodeEntry(entry, buffer);
+      updateBytes(entryAddress(index), buffer, SONG_DIR_ENTRY_SIZE);
+    }
+
+    bool readJournal(int slot, uint8_t& sequence, int& index, SongDirectoryEntry& entry) {
+      uint8_t buffer[SONG_JOURNAL_RECORD_SIZE];
+      readBytes(SONG_JOURNAL_START + slot * SONG_JOURNAL_RECORD_SIZE, buffer, SONG_JOURNAL_RECORD_SIZE);
+      if (crc16(buffer, SONG_JOURNAL_RECORD_SIZE - 2) != readUInt16(&buffer[SONG_JOURNAL_RECORD_SIZE - 2])) return false;
+      sequence = buffer[0];
+      index = buffer[1];
+      decodeEntry(&buffer[2], entry);
+      return entryAddress(index) >= 0;
+    }
+
+    void scanJournal() {
+      _journalSlot = SONG_JOURNAL_SLOTS - 1;
+      _journalSequence = 0;
+      bool found = false;
+      uint8_t sequence;
+      int index;
+      SongDirectoryEntry entry;
+      for (int i = 0; i < SONG_JOURNAL_SLOTS; i++) {
+        if (!readJournal(i, sequence, index, entry)) continue;
+        if (!found || (int8_t)(sequence - _journalSequence) > 0) {
+          _journalSlot = i;
+          _journalSequence = sequence;
+          found = true;
+        }
+      }
+    }
+
+    // entries are journaled to the next slot of the ring before the directory is written
+    void journalRecord(int index, const SongDirectoryEntry& entry, uint8_t* buffer) {
+      if (_journalSlot < 0) scanJournal();
+      _journalSlot = (_journalSlot + 1) % SONG_JOURNAL_SLOTS;
+      _journalSequence++;
+
+      buffer[0] = _journalSequence;
+      buffer[1] = index;
+      encodeEntry(entry, &buffer[2]);
+      writeUInt16(&buffer[SONG_JOURNAL_RECORD_SIZE - 2], crc16(buffer, SONG_JOURNAL_RECORD_SIZE - 2));
+    }
+
+    void journalEntry(int index, const SongDirectoryEntry& entry) {
+      uint8_t buffer[SONG_JOURNAL_RECORD_SIZE];
+      journalRecord(index, entry, buffer);
+      updateBytes(SONG_JOURNAL_START + _journalSlot * SONG_JOURNAL_RECORD_SIZE, buffer, SONG_JOURNAL_RECORD_SIZE);
+    }
+
+    void commitEntry(int index, const SongDirectoryEntry& entry) {
+      journalEntry(index, entry);
+      writeEntry(index, entry);
+    }
+
+    void markBlocks(uint16_t start, uint16_t length, bool used) {
+      if (length == 0) return;
+      for (uint16_t block = start / SONG_BLOCK_SIZE; block <= (start + length - 1) / SONG_BLOCK_SIZE; block++) {
+        if (used) _usedBlocks[block >> 3] |= 1 << (block & 7);
+        else _usedBlocks[block >> 3] &= ~(1 << (block & 7));
+      }
+    }
+
+    bool isBlockUsed(uint16_t block) {
+      return _usedBlocks[block >> 3] & (1 << (block & 7));
+    }
+
+    // reads every directory entry once - the current record of skipIndex is left out
+    void buildBlockMap(int skipIndex = -1) {
+      memset(_usedBlocks, 0, sizeof(_usedBlocks));
+      markBlocks(0, SONG_DIR_SIZE, true);
+      markBlocks(SONG_DATA_END, EEPROM.length() - SONG_DATA_END, true);
+      if (!hasDirectory()) return;
+      SongDirectoryEntry entry;
+      for (int i = 1; i <= MAX_SONGS; i++) {
+        if (i != skipIndex && readEntry(i, entry)) markBlocks(entry.offset, entry.length, true);
+      }
+    }
+
+    bool fits(uint16_t start, uint16_t length) {
+      if (start < SONG_DIR_SIZE || (unsigned long)start + length > SONG_DATA_END) return false;
+      for (uint16_t block = start / SONG_BLOCK_SIZE; block <= (start + length - 1) / SONG_BLOCK_SIZE; block++) {
+        if (isBlockUsed(block)) return false;
+      }
+      return true;
+    }
+
+    // first fit on block boundaries
+    int allocate(uint16_t length) {
+      uint16_t needed = (length + SONG_BLOCK_SIZE - 1) / SONG_BLOCK_SIZE;
+      uint16_t run = 0;
+      for (uint16_t block = 0; block < SONG_BLOCK_COUNT; block++) {
+        run = isBlockUsed(block) ? 0 : run + 1;
+        if (run == needed) return (block + 1 - needed) * SONG_BLOCK_SIZE;
+      }
+      return -1;
+    }
+
+    // encodes song into _record, returns the record length
+    uint16_t encodeRecord(const Song& song) {
+      SongRecordHeader header;
+      header.version = SONG_FORMAT_VERSION;
+      header.partMask = SongBinaryFormat::partMask(song);
+      header.length = SongBinaryFormat::payloadLength(header.partMask);
+
+      uint8_t* part = &_record[SONG_HEADER_SIZE];
+      for (int i = 0; i < CHANNELS; i++) {
+        if (!(header.partMask & (1 << i))) continue;
+        SongBinaryFormat::encodePart(song.parts[i], part);
+        part += SONG_PART_RECORD_SIZE;
+      }
+      header.crc = crc16(&_record[SONG_HEADER_SIZE], header.length);
+      SongBinaryFormat::encodeHeader(header, _record);
+      return SONG_HEADER_SIZE + header.length;
+    }
+
+    bool recordEquals(int address, uint16_t length) {
+      for (uint16_t i = 0; i < length; i++) {
+        if (EEPROM.read(address + i) != _record[i]) return false;
+      }
+      return true;
+    }
+
+    // the save task writes these in order: record, journal, directory entry
+    bool saveSegment(uint8_t segment, int& address, const uint8_t*& data, uint16_t& length) {
+      switch(segment) {
+        case 0: address = _saveOffset; data = _record; length = _saveLength; return true;
+        case 1: address = SONG_JOURNAL_START + _journalSlot * SONG_JOURNAL_RECORD_SIZE; data = _commit; length = SONG_JOURNAL_RECORD_SIZE; return true;
+        case 2: address = entryAddress(_saveIndex); data = &_commit[SONG_JOURNAL_RECORD_SIZE]; length = SONG_DIR_ENTRY_SIZE; return true;
+      }
+      return false;
+    }
+
+    void recover() {
+      if(!hasDirectory()) return;
+      scanJournal();
+
+      uint8_t sequence;
+      int index;
+      SongDirectoryEntry journaled, current;
+      if(!readJournal(_journalSlot, sequence, index, journaled)) return;
+      readEntry(index, current);
+      if(memcmp(&journaled, &current, sizeof(SongDirectoryEntry)) == 0) return;
+
+      writeEntry(index, journaled);
+      Serial.print(F("Recovered interrupted save of song "));
+      Serial.println(index);
+    }
+
+    void finishSave() {
+      Serial.print(F("Song saved successfully. Size: "));
+      Serial.print(_saveLength);
+      Serial.print(F(" | bytes written: "));
+      Serial.println(_saveWritten);
+      int index = _saveIndex;
+      _saveIndex = 0;
+      buildBlockMap(); // the eeprom is idle here, the last write has completed
+      if(_onSaveCompleted)
+        _onSaveCompleted(index);
     }
 
   public:
+    // Call from setup(): finishes a save that was cut off between journal and directory
+    // and builds the block map
+    void Init() {
+      recover();
+      buildBlockMap();
+    }
+
+    void OnSaveCompleted(SaveCompleted handler) {
+      _onSaveCompleted = handler;
+    }
+
+    // Encodes the song and starts writing it in the background, RunSave() does the writing.
+    // Returns false if the song can't be saved or a save is still running - nothing is written then.
+    bool BeginSave(const Song& song, int index) {
+      if(entryAddress(index) < 0) return false;
+      if(IsSaving()) {
+        Serial.println(F("Still saving the previous song - try again"));
+        return false;
+      }
+      if(!hasDirectory()) formatDirectory();
+
+      uint16_t length = encodeRecord(song);
+      uint16_t crc = crc16(_record, length);
+
+      SongDirectoryEntry current;
+      bool hasCurrent = readEntry(index, current);
+      if(hasCurrent && current.length == length && current.crc == crc && recordEquals(current.offset, length)) {
+        Serial.println(F("Song unchanged"));
+        if(_onSaveCompleted)
+          _onSaveCompleted(index);
+        return true;
+      }
+
+      // the spare holds an older version of this song - cheapest to update - else first fit
+      // around the current version, and only when the EEPROM is full over the current version
+      int offset = -1;
+      if(current.spare != SONG_DIR_EMPTY && fits(current.spare, length)) offset = current.spare;
+      if(offset < 0) offset = allocate(length);
+      if(offset < 0 && hasCurrent) {
+        buildBlockMap(index);
+        offset = allocate(length);
+        buildBlockMap();
+        if(offset >= 0) Serial.println(F("EEPROM full - overwriting the previous version"));
+      }
+      if(offset < 0) {
+        Serial.println(F("Not enough free EEPROM for the song"));
+        return false;
+      }
+
+      SongDirectoryEntry entry = {(uint16_t)offset, length, crc, hasCurrent ? current.offset : (uint16_t)SONG_DIR_EMPTY};
+      if(entry.spare == entry.offset) entry.spare = SONG_DIR_EMPTY;
+      journalRecord(index, entry, _commit);
+      encodeEntry(entry, &_commit[SONG_JOURNAL_RECORD_SIZE]);
+
+      _saveIndex = index;
+      _saveOffset = offset;
+      _saveLength = length;
+      _saveSegment = 0;
+      _savePosition = 0;
+      _saveDone = 0;
+      _saveWritten = 0;
+      return true;
+    }
+
+    // Call from loop(): compares up to SAVE_SCAN_PER_PASS bytes and starts at most one
+    // EEPROM write, never waiting for a write in progress
+    void RunSave() {
+      if(_saveIndex == 0) return;
+
+      for (uint8_t scanned = 0; scanned < SAVE_SCAN_PER_PASS; scanned++) {
+        if(!eeprom_is_ready()) return;
+
+        int address;
+        const uint8_t* data;
+        uint16_t length;
+        if(!saveSegment(_saveSegment, address, data, length)) {
+          finishSave();
+          return;
+        }
+        if(_savePosition >= length) {
+          _saveSegment++;
+          _savePosition = 0;
+          continue;
+        }
+
+        uint8_t value = data[_savePosition];
+        address += _savePosition++;
+        _saveDone++;
+        if(EEPROM.read(address) != value) {
+          EEPROM.write(address, value);
+          _saveWritten++;
+          return;
+        }
+      }
+    }
+
+    // blocks until the save in progress is done
+    void FinishSave() {
+      while(_saveIndex != 0) {
+        eeprom_busy_wait();
+        RunSave();
+      }
+    }
+
+    bool IsSaving() {
+      return _saveIndex != 0;
+    }
+
+    // 0..99
+    uint8_t SaveProgress() {
+      if(_saveIndex == 0) return 0;
+      return (unsigned long)_saveDone * 100 / (_saveLength + SONG_JOURNAL_RECORD_SIZE + SONG_DIR_ENTRY_SIZE + 1);
+    }
+
     bool SaveSong(const Song& song, int index) {
-      int offset = calculateAddress(index);
-      if(offset < 0) return false;
-      address = offset;
+      FinishSave();
+      if(!BeginSave(song, index)) return false;
+      FinishSave();
+      return true;
+    }
+
+    // decodes straight into song - its content is undefined when false is returned
+    bool LoadSong(int index, Song& song) {
+      if(index == _saveIndex) FinishSave();
+      SongDirectoryEntry entry;
+      if(!hasDirectory() || !readEntry(index, entry)) {
+        Serial.println(F("No valid song record"));
+        return false;
+      }
 
-      SongSerializer writer;
-      writer.serialize(song, writeLineToEEPROM);
+      uint8_t buffer[SONG_PART_RECORD_SIZE];
+      SongRecordHeader header;
+      readBytes(entry.offset, buffer, SONG_HEADER_SIZE);
+      if (!SongBinaryFormat::decodeHeader(buffer, header) || SONG_HEADER_SIZE + header.length != entry.length) {
+        Serial.println(F("No valid song record"));
+        return false;
+      }
 
-      writeLineToEEPROM("EOS\n");
+      uint16_t crc = crc16(buffer, SONG_HEADER_SIZE);
+      int address = entry.offset + SONG_HEADER_SIZE;
+      for (int i = 0; i < CHANNELS; i++) {
+        if (!(header.partMask & (1 << i))) {
+          resetPart(song.parts[i]);
+          continue;
+        }
+        readBytes(address, buffer, SONG_PART_RECORD_SIZE);
+        crc = crc16(buffer, SONG_PART_RECORD_SIZE, crc);
+        SongBinaryFormat::decodePart(buffer, song.parts[i]);
+        address += SONG_PART_RECORD_SIZE;
+      }
 
-      Serial.print("Song saved successfully. Size: ");
-      Serial.println(address - offset);
+      if (crc != entry.crc) {
+        Serial.println(F("Song record checksum mismatch"));
+        return false;
+      }
+
+      Serial.print(F("Song loaded successfully. Size: "));
+      Serial.println(entry.length);
+      return true;
+    }
+
+    bool DeleteSong(int index) {
+      if(entryAddress(index) < 0 || !hasDirectory()) return false;
+      FinishSave();
+      SongDirectoryEntry entry = {SONG_DIR_EMPTY, SONG_DIR_EMPTY, SONG_DIR_EMPTY, SONG_DIR_EMPTY};
+      commitEntry(index, entry);
+      buildBlockMap();
       return true;
     }
 
-    Song LoadSong(int index, bool &success) {
-      int offset = calculateAddress(index);
-      address = offset;
-      int endAddress = address + SONG_SIZE + 1000;
-      Song song = Song();
-      SerialSongParser parser(song);      
-      String line;
-      while (address < endAddress) {
-        char c = EEPROM.read(address++);
-        if (c == '\n' || address >= EEPROM.length()) {
-          // Process line
-          if (line.length() > 0) {
-            Serial.println(line);
-            
-            if(line=="EOS") break;
-
-            SlaveEnum target;
-            int partIndex = parser.parseCommand(line, target);
-          }
-          line = "";
-          if (address >= EEPROM.length()) break;
-        } else {
-          line += c;
+    bool HasSong(int index) {
+      SongDirectoryEntry entry;
+      return hasDirectory() && readEntry(index, entry);
+    }
+
+    // one line pr stored song: S <slot> <record as hex>, records are verified first
+    uint8_t ExportSongs() {
+      FinishSave();
+      if(!hasDirectory()) return 0;
+      uint8_t exported = 0;
+      char hex[3];
+      SongDirectoryEntry entry;
+      for (int i = 1; i <= MAX_SONGS; i++) {
+        if (!readEntry(i, entry)) continue;
+
+        uint16_t crc = 0xFFFF;
+        for (uint16_t b = 0; b < entry.length; b++) {
+          crc = crc16Update(crc, EEPROM.read(entry.offset + b));
         }
+        if (crc != entry.crc) {
+          Serial.print(F("Song record checksum mismatch, skipping song "));
+          Serial.println(i);
+          continue;
+        }
+
+        Serial.print(F("S "));
+        Serial.print(i);
+        Serial.print(F(" "));
+        for (uint16_t b = 0; b < entry.length; b++) {
+          sprintf_P(hex, PSTR("%02X"), EEPROM.read(entry.offset + b));
+          Serial.print(hex);
+        }
+        Serial.println();
+        exported++;
+      }
+      return exported;
+    }
+
+    void PrintDirectory() {
+      if(!hasDirectory()) {
+        Serial.println(F("No song directory"));
+        return;
+      }
+      char s[60];
+      unsigned long used = 0;
+      SongDirectoryEntry entry;
+      for (int i = 1; i <= MAX_SONGS; i++) {
+        if (!readEntry(i, entry)) continue;
+        sprintf_P(s, PSTR("song %2d => offset: %4u | size: %3u"), i, entry.offset, entry.length);
+        Serial.println(s);
+        used += entry.length;
       }
-      Serial.print("Song loaded successfully. Size: ");
-      Serial.println(address - offset);
-      success = true;
-      return song;
+      sprintf_P(s, PSTR("used: %lu | free: %lu bytes"), used, SONG_DATA_END - SONG_DIR_SIZE - used);
+      Serial.println(s);
     }
 };
 
-#endif
\ No newline at end of file
+#endif
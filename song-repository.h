@@ -10,16 +10,16 @@
 const int SD_CS_PIN = 53;
 
 void SetupSongRepository() {
-  Serial.print("Initializing SD card...");
+  Serial.print(F("Initializing SD card..."));
 
   if (!SD.begin(SD_CS_PIN)) {
-    Serial.println("Card failed, or not present.");
+    Serial.println(F("Card failed, or not present."));
     return;
   }
-  Serial.println("Card initialized.");  
+  Serial.println(F("Card initialized."));  
 }
 
-bool SaveSong(Song song, int index) {
+bool SaveSong(const Song& song, int index) {
   //printSong(song);
 
   char filename[15];
@@ -33,7 +33,7 @@ bool SaveSong(Song song, int index) {
   SongWriter writer;
   writer.Save(filename, song);
 
-  Serial.print("Song saved to: ");
+  Serial.print(F("Song saved to: "));
   Serial.println(filename);  
   return true;
 }
@@ -42,7 +42,7 @@ Song LoadSong(int index, bool &success) {
   char filename[15];
   snprintf(filename, sizeof(filename), "song_%d.dat", index);
   if(!SD.exists(filename)) {
-    Serial.print("File does not exist: ");
+    Serial.print(F("File does not exist: "));
     Serial.println(filename);
     success = false;
     return;
@@ -50,7 +50,7 @@ Song LoadSong(int index, bool &success) {
 
   File file = SD.open(filename);
   if(!file) {
-    Serial.print("error accessing file: ");
+    Serial.print(F("error accessing file: "));
     Serial.println(filename);
     success = false;
     return;    
@@ -59,7 +59,7 @@ Song LoadSong(int index, bool &success) {
   Song song = Song();
   SerialSongParser parser(song);
 
-  Serial.println("### RAW SONG CONTENT AT LOAD SONG ###");
+  Serial.println(F("### RAW SONG CONTENT AT LOAD SONG ###"));
 
   while (file.available()) {
     String command = file.readStringUntil('\n');
@@ -67,7 +67,7 @@ Song LoadSong(int index, bool &success) {
     SlaveEnum target;
     int partIndex = parser.parseCommand(command, target);
     if (partIndex == -1) {
-      Serial.println("Error parsing command.");
+      Serial.println(F("Error parsing command."));
       success = false;
       return Song();
     }
@@ -75,7 +75,7 @@ Song LoadSong(int index, bool &success) {
 
   if(!success) {
     file.close();
-    Serial.print("Song loaded from: ");
+    Serial.print(F("Song loaded from: "));
     Serial.println(filename);  
     return Song();
   }
@@ -91,14 +91,14 @@ void PeekSong(int index) {
   char filename[15];
   snprintf(filename, sizeof(filename), "song_%d.dat", index);
   if(!SD.exists(filename)) {
-    Serial.print("File does not exist: ");
+    Serial.print(F("File does not exist: "));
     Serial.println(filename);
     return;
   }
 
   File file = SD.open(filename);
   if(!file) {
-    Serial.print("error accessing file: ");
+    Serial.print(F("error accessing file: "));
     Serial.println(filename);
     return;    
   }  
@@ -35,9 +35,9 @@ class SongSerializer {
 
         // Drum Sequencer Commands
         for (int channelIndex = 0; channelIndex < 5; channelIndex++) {
-          const DrumSequencerChannel& channel = part.drumSequencer.channel[channelIndex];
+          const DrumPatternChannel& channel = part.drumSequencer.channel[channelIndex];
 
-          if(!channel.enabled)
+          if(!channel.Enabled())
             continue;
           
           line = String(partIndex) + ":seq:" + String(channelIndex) + "=";
@@ -57,13 +57,13 @@ class SongSerializer {
           }
           lineCallback(line);
 
-          line = String(partIndex) + ":seq:" + String(channelIndex) + ".div=" + String(channel.divider);
+          line = String(partIndex) + ":seq:" + String(channelIndex) + ".div=" + String(channel.Divider());
           lineCallback(line);
 
-          line = String(partIndex) + ":seq:" + String(channelIndex) + ".ena=" + String(channel.enabled ? "1" : "0");
+          line = String(partIndex) + ":seq:" + String(channelIndex) + ".ena=" + String(channel.Enabled() ? "1" : "0");
           lineCallback(line);
 
-          line = String(partIndex) + ":seq:" + String(channelIndex) + ".last=" + String(channel.lastStep);
+          line = String(partIndex) + ":seq:" + String(channelIndex) + ".last=" + String(channel.LastStep());
           lineCallback(line);
         }
       }
@@ -0,0 +1,138 @@
+#ifndef SongTimeline_h
+#define SongTimeline_h
+
+#include <Arduino.h>
+#include "shared.h"
+#include "channel.h"
+
+#define TIMELINE_PULSES_PR_BAR 96 // 4/4 at 24 PPQN
+
+/*
+* The part sequence a song plays, precomputed from the channels instead of
+* following the chain pulse by pulse. Positions are clock pulses since the
+* first part started.
+*
+* A part with lastStep L-1 and R repeats (0 counts as 1) started on a
+* downbeat plays for 24*ceil(RL/4) pulses - its chain target starts on the
+* first downbeat after it completed (see SongTransport). Every part has one
+* chain target, so a song either ends or returns to a part it already
+* played and loops from there - at most CHANNELS entries either way.
+*/
+struct TimelineEntry {
+  uint8_t part;
+  unsigned long start;  // pulses from the song start
+  unsigned long length; // pulses until the chained part starts
+};
+
+class SongTimeline {
+  private:
+    TimelineEntry _entries[CHANNELS];
+    uint8_t _count = 0;
+    int8_t _firstPart = -1;
+    int8_t _loopEntry = -1; // entry the last part chains back to, -1 => the song ends
+    unsigned long _duration = 0; // until the song ends or starts looping
+
+  public:
+    static unsigned long PartLength(uint8_t lastStep, uint8_t repeats) {
+      unsigned long steps = (unsigned long)(lastStep + 1) * max(repeats, (uint8_t)1);
+      return 24 * ((steps + 3) / 4); // 6 pulses pr step, rounded up to the downbeat
+    }
+
+    void Build(Channel* channels, int8_t firstPart) {
+      _count = 0;
+      _firstPart = firstPart;
+      _loopEntry = -1;
+      _duration = 0;
+
+      int8_t played[CHANNELS]; // entry pr part, -1 => not played yet
+      for(int i=0; i<CHANNELS; i++) played[i] = -1;
+
+      int8_t part = firstPart;
+      while(part >= 0 && part < CHANNELS) {
+        if(played[part] >= 0) {
+          _loopEntry = played[part];
+          break;
+        }
+        played[part] = _count;
+        TimelineEntry& entry = _entries[_count++];
+        entry.part = part;
+        entry.start = _duration;
+        entry.length = PartLength(channels[part].LastStep(), channels[part].Repeats());
+        _duration += entry.length;
+        part = (int8_t)channels[part].ChainTo(); // targets past the last channel end the song like -1
+      }
+    }
+
+    uint8_t Count() {
+      return _count;
+    }
+
+    const TimelineEntry& Entry(uint8_t index) {
+      return _entries[index];
+    }
+
+    int8_t FirstPart() {
+      return _firstPart;
+    }
+
+    bool Loops() {
+      return _loopEntry >= 0;
+    }
+
+    int8_t LoopEntry() {
+      return _loopEntry;
+    }
+
+    unsigned long Duration() {
+      return _duration;
+    }
+
+    // entry following the given one, -1 => the song ends after it
+    int8_t NextEntry(int8_t index) {
+      if(index < 0) return -1;
+      if(index + 1 < _count) return index + 1;
+      return _loopEntry;
+    }
+
+    // entry playing at the pulse and the pulses into it, -1 => past the end of the song
+    int8_t Locate(unsigned long pulse, unsigned long& offset) {
+      if(_count == 0) return -1;
+      if(pulse >= _duration) {
+        if(_loopEntry < 0) return -1;
+        unsigned long loopStart = _entries[_loopEntry].start;
+        pulse = loopStart + (pulse - loopStart) % (_duration - loopStart);
+      }
+      int8_t index = _count - 1;
+      while(index > 0 && _entries[index].start > pulse) index--;
+      offset = pulse - _entries[index].start;
+      return index;
+    }
+
+    void Print(unsigned long position) {
+      char s[100];
+      for(int i=0; i<_count; i++) {
+        sprintf_P(s, PSTR("%d: part %d => bar: %3lu | pulses: %5lu | length: %5lu"), i, _entries[i].part,
+                _entries[i].start / TIMELINE_PULSES_PR_BAR + 1, _entries[i].start, _entries[i].length);
+        Serial.println(s);
+      }
+
+      unsigned long offset = 0;
+      int8_t playing = Locate(position, offset);
+      sprintf_P(s, PSTR("duration: %lu pulses (%lu bars)"), _duration, (_duration + TIMELINE_PULSES_PR_BAR - 1) / TIMELINE_PULSES_PR_BAR);
+      Serial.print(s);
+      if(_loopEntry >= 0) {
+        Serial.print(F(" then loops from entry "));
+        Serial.print(_loopEntry);
+      }
+      Serial.println();
+      sprintf_P(s, PSTR("position: bar %lu beat %lu"), position / TIMELINE_PULSES_PR_BAR + 1, (position % TIMELINE_PULSES_PR_BAR) / 24 + 1);
+      Serial.print(s);
+      if(playing >= 0) {
+        sprintf_P(s, PSTR(" | entry %d part %d + %lu pulses"), playing, _entries[playing].part, offset);
+        Serial.print(s);
+      }
+      Serial.println();
+    }
+};
+
+#endif
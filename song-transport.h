@@ -0,0 +1,79 @@
+#ifndef SongTransport_h
+#define SongTransport_h
+
+#include "shared.h"
+#include "channel.h"
+
+/*
+* Clock to channel plumbing: counts PPQN, pulses every channel and stops
+* completed parts / starts chained parts on the downbeat (ppqn 0).
+* Kept free of i2c and UI so the host clock simulator drives the exact same
+* code as the sketch.
+*/
+class SongTransport {
+  private:
+    Channel* _channels;
+    uint8_t _ppqnCounter = 0;
+    bool _partCompleted = false;
+    int8_t _completedPart = -1;
+    bool _chainToNextPart = false;
+    int8_t _nextPart = -1;
+
+  public:
+    SongTransport(Channel* channels) : _channels(channels) {}
+
+    void Pulse() {
+      _ppqnCounter = (_ppqnCounter + 1) % 24;
+      for(int i=0; i<CHANNELS; i++)
+        _channels[i].Pulse(_ppqnCounter);
+      HandlePartTransitions();
+    }
+
+    // call from the channels' part completed handler - returns false when the song ends here
+    bool PartCompleted(uint8_t channelNumber, int8_t chainToChannel) {
+      _completedPart = channelNumber;
+      _partCompleted = true;
+
+      if(chainToChannel == -1) return false;
+      if(chainToChannel < CHANNELS) {
+        _nextPart = chainToChannel;
+        _chainToNextPart = true;
+      }
+      return true;
+    }
+
+    void HandlePartTransitions() {
+      if(_partCompleted && _ppqnCounter == 0 && _completedPart >= 0 && _completedPart < CHANNELS) {
+        _partCompleted = false;
+        _channels[_completedPart].Stop();
+      }
+
+      if(_chainToNextPart && _ppqnCounter == 0 && _nextPart >= 0 && _nextPart < CHANNELS) {
+        _chainToNextPart = false;
+        _channels[_nextPart].Start();
+      }
+    }
+
+    // jump into a part: the playing parts are stopped and pending transitions dropped - call on a downbeat
+    void StartAt(uint8_t part, uint16_t steps) {
+      _partCompleted = false;
+      _chainToNextPart = false;
+      for(int i=0; i<CHANNELS; i++) {
+        if(_channels[i].IsStarted())
+          _channels[i].Stop();
+      }
+      _channels[part].StartAt(steps);
+    }
+
+    void Reset() {
+      _ppqnCounter = 0;
+      _partCompleted = false;
+      _chainToNextPart = false;
+    }
+
+    uint8_t PpqnCounter() {
+      return _ppqnCounter;
+    }
+};
+
+#endif
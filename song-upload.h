@@ -0,0 +1,296 @@
+#ifndef SongUpload_h
+#define SongUpload_h
+
+#include <Arduino.h>
+#include "shared.h"
+#include "song-binary-format.h"
+
+/*
+* Framed binary song upload over Serial
+*
+* The "upload" command switches the serial port to binary frames until an
+* end or abort frame arrives, or nothing has been received for
+* UPLOAD_TIMEOUT ms:
+*
+*   0x7E | type | sequence | length | payload[length] | crc16 (little endian)
+*
+* the crc16 covers type, sequence, length and payload. Types:
+*   'B' begin  payload: song slot (0 => only apply the song, 1..MAX_SONGS => also save it there)
+*   'D' data   payload: the next bytes of a song record (see song-binary-format.h)
+*   'E' end    the record is complete - verified and committed
+*   'A' abort
+*   'F' finish ends an import session
+*
+* The "import" command opens a session for a whole setlist: any number of
+* begin, data..., end sequences (sequence numbers keep counting), each song
+* saved to its slot (1..MAX_SONGS) as soon as it is verified, closed by a
+* finish frame. The current song is left alone. A begin frame is only
+* ACK'ed once the previous song has been written (see OnCanBegin) - the
+* loop keeps running meanwhile, and the sender simply waits for the ACK.
+*
+* Every accepted frame is answered with ACK (0x06) | sequence. A bad or out
+* of order frame is answered with NAK (0x15) | expected sequence and the
+* sender goes back and resends from there (the frames it had in flight are
+* NAK'ed as well, later NAKs for the same sequence can be ignored until it
+* has been resent). The sender may have up to
+* UPLOAD_WINDOW_BYTES of unacknowledged frames in flight - what the serial
+* receive buffer holds between two loop passes.
+*
+* The record is decoded part by part into the staging song. The completed
+* handler is only called after the record checksum matched, so a broken
+* upload never touches the current song. A record that is rejected (bad
+* content or checksum) is dropped, but the session stays open: its frames
+* are NAK'ed until the sender begins the next song, aborts or finishes, or
+* the line has been idle for UPLOAD_TIMEOUT. The frames still in flight
+* are never taken for text commands.
+*/
+
+#define UPLOAD_FRAME_START 0x7E
+#define UPLOAD_ACK 0x06
+#define UPLOAD_NAK 0x15
+#define UPLOAD_MAX_PAYLOAD 26 // a full frame is 32 bytes
+#define UPLOAD_WINDOW_BYTES 64 // SERIAL_RX_BUFFER_SIZE on the Mega
+#define UPLOAD_TIMEOUT 2000
+
+#define UPLOAD_FRAME_BEGIN 'B'
+#define UPLOAD_FRAME_DATA 'D'
+#define UPLOAD_FRAME_END 'E'
+#define UPLOAD_FRAME_ABORT 'A'
+#define UPLOAD_FRAME_FINISH 'F'
+
+typedef void (*UploadCompleted)(int, bool); // song slot (0 => not to be saved), part of an import
+typedef bool (*UploadCanBegin)(); // false => hold the next begin frame, a save is still being written
+
+class SongUploadReceiver {
+  private:
+    enum FrameState { WAIT_START, TYPE, SEQUENCE, LENGTH, PAYLOAD, CRC_LOW, CRC_HIGH };
+
+    Song& _staging;
+    UploadCompleted _onCompleted = nullptr;
+    UploadCanBegin _canBegin = nullptr;
+    bool _beginHeld = false; // a valid begin frame waits for _canBegin, nothing more is read until then
+    bool _active = false;
+    bool _import = false;
+    uint8_t _imported = 0;
+    unsigned long _lastReceived = 0;
+
+    // frame being received
+    uint8_t _state = WAIT_START;
+    uint8_t _type = 0;
+    uint8_t _sequence = 0;
+    uint8_t _length = 0;
+    uint8_t _received = 0;
+    uint16_t _crc = 0;
+    uint8_t _payload[UPLOAD_MAX_PAYLOAD];
+
+    // record being assembled
+    uint8_t _expectedSequence = 0;
+    int _slot = -1; // -1 => no begin frame yet
+    bool _hasHeader = false;
+    SongRecordHeader _header;
+    uint16_t _recordCrc = 0;
+    uint16_t _recordPosition = 0;
+    uint8_t _nextPart = 0;
+    uint8_t _block[SONG_PART_RECORD_SIZE];
+    uint8_t _blockFill = 0;
+
+    void reply(uint8_t code, uint8_t sequence) {
+      Serial.write(code);
+      Serial.write(sequence);
+    }
+
+    void finish(const __FlashStringHelper* message) {
+      _active = false;
+      Serial.println(message);
+    }
+
+    // the header, then one block pr stored part
+    bool acceptRecordByte(uint8_t data) {
+      _block[_blockFill++] = data;
+      _recordPosition++;
+
+      if(!_hasHeader) {
+        if(_blockFill < SONG_HEADER_SIZE) return true;
+        _blockFill = 0;
+        if(!SongBinaryFormat::decodeHeader(_block, _header)) return false;
+        _hasHeader = true;
+        _recordCrc = 0xFFFF;
+        _nextPart = 0;
+        return true;
+      }
+
+      if(_recordPosition > SONG_HEADER_SIZE + _header.length) return false;
+      _recordCrc = crc16Update(_recordCrc, data);
+      if(_blockFill < SONG_PART_RECORD_SIZE) return true;
+      _blockFill = 0;
+
+      while(_nextPart < CHANNELS && !(_header.partMask & (1 << _nextPart))) _nextPart++;
+      if(_nextPart >= CHANNELS) return false;
+      SongBinaryFormat::decodePart(_block, _staging.parts[_nextPart++]);
+      return true;
+    }
+
+    bool handleFrame() {
+      switch(_type) {
+        case UPLOAD_FRAME_BEGIN:
+          if(_length != 1 || _payload[0] > MAX_SONGS || (_import && _payload[0] == 0)) return false;
+          _slot = _payload[0];
+          _hasHeader = false;
+          _recordPosition = 0;
+          _blockFill = 0;
+          resetSong(_staging);
+          return true;
+
+        case UPLOAD_FRAME_DATA:
+          if(_slot < 0) return false;
+          for(uint8_t i=0; i<_length; i++) {
+            if(!acceptRecordByte(_payload[i])) {
+              _slot = -1;
+              return false;
+            }
+          }
+          return true;
+
+        case UPLOAD_FRAME_END:
+          if(_slot >= 0 && _hasHeader
+              && _recordPosition == SONG_HEADER_SIZE + _header.length
+              && _recordCrc == _header.crc) return true;
+          _slot = -1;
+          return false;
+
+        case UPLOAD_FRAME_ABORT:
+          return true;
+
+        case UPLOAD_FRAME_FINISH:
+          return _import;
+      }
+      return false;
+    }
+
+    // a complete, undamaged frame with the expected sequence
+    void acceptFrame() {
+      if(!handleFrame()) {
+        reply(UPLOAD_NAK, _expectedSequence);
+        return;
+      }
+      reply(UPLOAD_ACK, _sequence);
+      _expectedSequence++;
+
+      if(_type == UPLOAD_FRAME_ABORT) {
+        finish(F("###UPLOAD ABORTED###"));
+      } else if(_type == UPLOAD_FRAME_FINISH) {
+        Serial.print(F("Songs imported: "));
+        Serial.println(_imported);
+        finish(F("###IMPORT COMPLETED###"));
+      } else if(_type == UPLOAD_FRAME_END) {
+        int slot = _slot;
+        _slot = -1;
+        if(_import) _imported++;
+        else finish(F("###UPLOAD COMPLETED###"));
+        if(_onCompleted)
+          _onCompleted(slot, _import);
+      }
+    }
+
+  public:
+    SongUploadReceiver(Song& staging) : _staging(staging) {}
+
+    void OnUploadCompleted(UploadCompleted handler) {
+      _onCompleted = handler;
+    }
+
+    void OnCanBegin(UploadCanBegin handler) {
+      _canBegin = handler;
+    }
+
+    void Begin(unsigned long now, bool import = false) {
+      _active = true;
+      _import = import;
+      _imported = 0;
+      _lastReceived = now;
+      _state = WAIT_START;
+      _expectedSequence = 0;
+      _slot = -1;
+      _beginHeld = false;
+      if(import) Serial.println(F("###IMPORT READY###"));
+      else Serial.println(F("###UPLOAD READY###"));
+    }
+
+    bool IsActive() {
+      return _active;
+    }
+
+    // Call from loop() instead of the text command handling while IsActive()
+    void Run(unsigned long now) {
+      if(!_active) return;
+      if(_beginHeld) {
+        _lastReceived = now; // waiting on ourselves, not on the sender
+        if(_canBegin && !_canBegin()) return;
+        _beginHeld = false;
+        acceptFrame();
+      }
+
+      // what arrived while the loop was busy counts before the timeout does
+      if(!Serial.available()) {
+        if(now - _lastReceived > UPLOAD_TIMEOUT) finish(F("###UPLOAD TIMEOUT###"));
+        return;
+      }
+
+      while(_active && Serial.available()) {
+        uint8_t data = Serial.read();
+        _lastReceived = now;
+
+        switch(_state) {
+          case WAIT_START:
+            if(data == UPLOAD_FRAME_START) _state = TYPE;
+            break;
+          case TYPE:
+            _type = data;
+            _crc = crc16Update(0xFFFF, data);
+            _state = SEQUENCE;
+            break;
+          case SEQUENCE:
+            _sequence = data;
+            _crc = crc16Update(_crc, data);
+            _state = LENGTH;
+            break;
+          case LENGTH:
+            _length = data;
+            _received = 0;
+            _crc = crc16Update(_crc, data);
+            if(_length > UPLOAD_MAX_PAYLOAD) {
+              reply(UPLOAD_NAK, _expectedSequence);
+              _state = WAIT_START;
+            } else {
+              _state = (_length == 0) ? CRC_LOW : PAYLOAD;
+            }
+            break;
+          case PAYLOAD:
+            _payload[_received++] = data;
+            _crc = crc16Update(_crc, data);
+            if(_received == _length) _state = CRC_LOW;
+            break;
+          case CRC_LOW:
+            _crc ^= data;
+            _state = CRC_HIGH;
+            break;
+          case CRC_HIGH:
+            _state = WAIT_START;
+            _crc ^= (uint16_t)data << 8;
+            // damaged and out of order frames are dropped, the sender resends from the expected one
+            if(_crc != 0 || _sequence != _expectedSequence) {
+              reply(UPLOAD_NAK, _expectedSequence);
+              break;
+            }
+            if(_type == UPLOAD_FRAME_BEGIN && _canBegin && !_canBegin()) {
+              _beginHeld = true;
+              return;
+            }
+            acceptFrame();
+            break;
+        }
+      }
+    }
+};
+
+#endif
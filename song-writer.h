@@ -15,7 +15,7 @@ class SongWriter {
       if (file) {
         file.println(line);
       } else {
-        Serial.println("Error writing line to file.");
+        Serial.println(F("Error writing line to file."));
       }
     }
 
@@ -25,7 +25,7 @@ class SongWriter {
 
         // Song Programmer Command
         String line = String(partIndex) + "=" + 
-                      String(part.drumSequencer.channel[0].lastStep / 16 + 1) + " " + 
+                      String(part.drumSequencer.channel[0].LastStep() / 16 + 1) + " " + 
                       String(part.repeats) + " " + 
                       String(part.chainTo);
         writeLine(line);
@@ -44,7 +44,7 @@ class SongWriter {
 
         // Drum Sequencer Commands
         for (int channelIndex = 0; channelIndex < 5; channelIndex++) {
-          const DrumSequencerChannel& channel = part.drumSequencer.channel[channelIndex];
+          const DrumPatternChannel& channel = part.drumSequencer.channel[channelIndex];
           
           line = String(partIndex) + ":seq:" + String(channelIndex) + "=";
           for (int pageIndex = 0; pageIndex < 4; pageIndex++) {
@@ -63,13 +63,13 @@ class SongWriter {
           }
           writeLine(line);
 
-          line = String(partIndex) + ":seq:" + String(channelIndex) + ".div=" + String(channel.divider);
+          line = String(partIndex) + ":seq:" + String(channelIndex) + ".div=" + String(channel.Divider());
           writeLine(line);
 
-          line = String(partIndex) + ":seq:" + String(channelIndex) + ".ena=" + String(channel.enabled ? "1" : "0");
+          line = String(partIndex) + ":seq:" + String(channelIndex) + ".ena=" + String(channel.Enabled() ? "1" : "0");
           writeLine(line);
 
-          line = String(partIndex) + ":seq:" + String(channelIndex) + ".last=" + String(channel.lastStep);
+          line = String(partIndex) + ":seq:" + String(channelIndex) + ".last=" + String(channel.LastStep());
           writeLine(line);
         }
       }
@@ -83,13 +83,13 @@ class SongWriter {
     void Save(const char* filename, const Song& song) {
       file = SD.open(filename, FILE_WRITE);
       if (!file) {
-        Serial.print("Error opening file: ");
+        Serial.print(F("Error opening file: "));
         Serial.println(filename);
       }
-      Serial.println("### RAW SONG CONTENT AT SAVE SONG ###");
+      Serial.println(F("### RAW SONG CONTENT AT SAVE SONG ###"));
 
       convertSongToLines(song);
-      Serial.println("Song saved successfully.");
+      Serial.println(F("Song saved successfully."));
       if (file) {
         file.close();
       }      